@@ -0,0 +1,137 @@
+#pragma once
+#include <string>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include <cstdint>
+#include <atomic>
+#include <sys/types.h>
+#include <opencv2/core.hpp>
+#include "facelock/capture_protocol.h"
+
+namespace facelock {
+
+// One aligned face as produced by the helper, with detector metadata
+struct CapturedFace {
+    cv::Mat     bgr;                // aligned 112x112 BGR crop
+    float       score        = 0.f; // detector confidence
+    float       sharpness    = 0.f; // Laplacian variance of the crop
+    float       brightness   = 0.f; // mean gray level of the crop
+    float       quality      = 0.f; // helper's 0..1 selection score
+    float       yaw          = 0.f; // landmark pose, 0 = frontal
+    float       pitch        = 0.f;
+    int         window       = 1;   // faces that passed and competed for this one
+    cv::Rect2f  bbox;               // face box in frame coordinates
+    cv::Point2f landmarks[5];       // eyes, nose, mouth corners (frame coords)
+    uint64_t    timestamp_us = 0;   // CLOCK_MONOTONIC frame time
+};
+
+// Checks the helper applies to every detected face; faces that fail
+// never reach the daemon and are only counted (see CaptureReject)
+struct CaptureQuality {
+    float min_confidence = 0.7f;   // detector confidence
+    float min_face       = 80.f;   // face width, frame pixels
+    float max_yaw        = 0.35f;  // landmark pose limits
+    float max_pitch      = 0.25f;
+    float min_sharpness  = 30.f;   // Laplacian variance of the aligned crop
+    int   window         = 3;      // frames compared before the best face is sent
+};
+
+// Faces the helper dropped, by CaptureReject reason
+struct CaptureRejects {
+    uint64_t count[CAPTURE_REJECT_COUNT] = {};
+
+    uint64_t total() const {
+        uint64_t n = 0;
+        for (uint64_t c : count) n += c;
+        return n;
+    }
+    CaptureRejects since(const CaptureRejects& earlier) const {
+        CaptureRejects d;
+        for (int i = 0; i < CAPTURE_REJECT_COUNT; ++i)
+            d.count[i] = count[i] - earlier.count[i];
+        return d;
+    }
+    void add(const CaptureRejects& more) {
+        for (int i = 0; i < CAPTURE_REJECT_COUNT; ++i) count[i] += more.count[i];
+    }
+};
+
+// called with the faces the helper dropped, each time a record reports some
+using RejectSink = std::function<void(const CaptureRejects&)>;
+
+// Long-lived camera capture service. Keeps one facelock-camera-helper
+// running in --serve mode so the V4L2 device and the face detector stay
+// open between requests; camera access remains confined to the helper
+// process (the daemon itself never links videoio).
+class CameraService {
+public:
+    // idle_timeout_sec: stop the helper (and release the camera) after this
+    // many seconds without a request; 0 keeps it running indefinitely.
+    // backend: helper capture backend, "auto" | "v4l2" | "opencv".
+    CameraService(const std::string& helper_path, int camera_device,
+                  int idle_timeout_sec, const std::string& backend = "auto",
+                  const CaptureQuality& quality = {});
+    ~CameraService();
+
+    // grab one aligned 112x112 BGR face. Serialised: one caller at a time
+    // owns the camera.
+    bool capture(CapturedFace& out, int timeout_ms = 5000);
+
+    // stream faces from the running helper until on_face returns false or
+    // timeout_ms elapses. Returns the number of faces delivered.
+    // `interrupt`, if set, is polled between faces (at least every 100 ms,
+    // also while no face is in view) and ends the stream when it returns true.
+    // `on_rejects` receives the rejects reported during this stream only.
+    int stream(const std::function<bool(CapturedFace&)>& on_face, int timeout_ms,
+               const std::function<bool()>& interrupt = nullptr,
+               const RejectSink& on_rejects = nullptr);
+
+    void stop();
+
+    // running totals of faces the helper rejected, camera-wide (every
+    // request's stream); per-request counts come from stream()'s on_rejects
+    CaptureRejects rejects() const;
+
+private:
+    std::string    helper_path_;
+    int            camera_device_;
+    int            idle_timeout_sec_;
+    std::string    backend_;
+    CaptureQuality quality_;
+
+    std::atomic<uint64_t> rejects_[CAPTURE_REJECT_COUNT] = {};
+
+    std::mutex              mtx_;
+    std::condition_variable idle_cv_;
+    std::thread             idle_thread_;
+    bool                    running_ = true;
+
+    pid_t pid_        = -1;
+    int   to_helper_  = -1;
+    int   from_helper_ = -1;
+    std::chrono::steady_clock::time_point last_used_;
+
+    bool spawn_locked();
+    void kill_locked();
+    bool request_locked(CapturedFace& out, int timeout_ms);
+    bool ensure_running_locked();
+
+    // read one framed record; `out` is filled only for CAPTURE_OK records.
+    // Its rejects go to the running totals and to `on_rejects`.
+    bool read_record(CaptureRecordHeader& hdr, CapturedFace& out,
+                     std::chrono::steady_clock::time_point deadline,
+                     const RejectSink& on_rejects = nullptr);
+    void idle_loop();
+
+    // wait up to timeout_ms for the helper to have output
+    bool wait_readable(int timeout_ms);
+
+    // read exactly n bytes from the helper before the deadline
+    bool read_full(void* buf, size_t n,
+                   std::chrono::steady_clock::time_point deadline);
+};
+
+} // namespace facelock
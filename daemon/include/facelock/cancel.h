@@ -0,0 +1,18 @@
+#pragma once
+#include <atomic>
+
+namespace facelock {
+
+// Set once the client a request works for has gone away. Long-running
+// steps poll it between units of work (frames, bursts, batches) and stop
+// early; nothing is interrupted mid-step.
+class CancelToken {
+public:
+    void cancel() { flag_.store(true, std::memory_order_relaxed); }
+    bool cancelled() const { return flag_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<bool> flag_{false};
+};
+
+} // namespace facelock
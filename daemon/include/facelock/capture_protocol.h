@@ -0,0 +1,75 @@
+#pragma once
+// Wire format between facelock-camera-helper (--serve / --stream) and the
+// daemon. Shared by both sides; keep it free of OpenCV types.
+#include <cstdint>
+
+namespace facelock {
+
+constexpr uint32_t CAPTURE_MAGIC   = 0x4B434C46u;   // "FLCK" little-endian
+constexpr uint16_t CAPTURE_VERSION = 2;
+
+enum CaptureStatus : uint8_t {
+    CAPTURE_OK      = 0,   // face record, payload follows
+    CAPTURE_NO_FACE = 3,   // no face before the helper's own deadline; while
+                           // streaming, a periodic report of rejects only
+    CAPTURE_END     = 4,   // end of a --serve stream (ack for 'P')
+};
+
+// Why the helper dropped a detected face before it reached the daemon;
+// indexes CaptureRecordHeader::rejects. Checked in this order, the
+// first failing check is the one counted.
+enum CaptureReject : uint8_t {
+    REJECT_CONFIDENCE = 0,   // detector confidence below --min-confidence
+    REJECT_SIZE,             // face narrower than --min-face pixels
+    REJECT_POSE,             // turned or tilted past --max-yaw / --max-pitch
+    REJECT_BLUR,             // aligned crop sharpness below --min-sharpness
+    REJECT_DARK,             // aligned crop too dark
+    REJECT_BRIGHT,           // aligned crop washed out
+    CAPTURE_REJECT_COUNT
+};
+
+constexpr const char* CAPTURE_REJECT_NAMES[CAPTURE_REJECT_COUNT] = {
+    "confidence", "size", "pose", "blur", "dark", "bright"
+};
+
+// --serve commands, one byte each on the helper's stdin
+constexpr char CAPTURE_CMD_FACE  = 'F';   // one record, OK or NO_FACE
+constexpr char CAPTURE_CMD_START = 'S';   // stream OK records until 'P'
+constexpr char CAPTURE_CMD_PAUSE = 'P';   // stop streaming, reply with END
+constexpr char CAPTURE_READY     = 'R';   // sent once after warmup
+
+// Every record is this fixed header followed by `payload_len` bytes of
+// image data (height x width x channels, row-major, BGR or gray).
+// `record_len` covers header + payload so readers can skip what they do
+// not understand.
+#pragma pack(push, 1)
+struct CaptureRecordHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t  status;
+    uint8_t  channels;
+    uint32_t record_len;
+    uint32_t payload_len;
+    uint16_t width;
+    uint16_t height;
+    uint64_t timestamp_us;    // CLOCK_MONOTONIC time the frame was grabbed
+    float    score;           // detector confidence
+    float    sharpness;       // Laplacian variance of the aligned crop
+    float    brightness;      // mean gray level of the aligned crop
+    float    bbox[4];         // x, y, w, h in frame coordinates
+    float    landmarks[10];   // 5 x (x, y) in frame coordinates
+    float    quality;         // 0..1 score the face was selected on
+    float    yaw;             // landmark pose: nose offset from the eye midpoint / eye distance
+    float    pitch;           // landmark pose: nose height between eyes and mouth, 0 = canonical
+    uint16_t window;          // faces that passed the checks and competed for this record
+    uint16_t rejects[CAPTURE_REJECT_COUNT];  // faces dropped since the previous record, any status
+    uint16_t detect_time;     // detector run on this face's frame, 10 µs units (saturates)
+    uint16_t align_time;      // alignment and quality measures of this face, 10 µs units
+    uint8_t  reserved[2];
+};
+#pragma pack(pop)
+
+static_assert(sizeof(CaptureRecordHeader) == 128,
+              "capture record header layout changed");
+
+} // namespace facelock
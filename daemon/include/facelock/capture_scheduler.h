@@ -0,0 +1,114 @@
+#pragma once
+#include <deque>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+#include <opencv2/core.hpp>
+#include "facelock/camera_service.h"
+#include "facelock/cancel.h"
+
+namespace facelock {
+
+// One captured and embedded frame of a shared burst
+struct BurstFrame {
+    std::vector<float> embedding;     // empty if embedding failed
+    int64_t            captured_ms;   // steady clock, when it was embedded
+};
+
+// Arbitrates the camera between requests.
+//
+// Auth-style requests share bursts: the first one becomes the leader,
+// runs the camera stream and embeds each face once with its model;
+// requests for the same model arriving while the burst runs attach to
+// it, replay the frames captured in the last `coalesce_ms`, and score
+// every following frame on their own thread against their own gallery.
+// The burst ends when no attached request wants more frames.
+//
+// Exclusive streams (enrollment) keep the camera to themselves but are
+// paused whenever an auth is waiting, and resume once it is done.
+//
+// A cancelled request detaches within CANCEL_POLL_MS, wherever it is
+// waiting; once no attached request is left the camera stream stops
+// and no further faces are embedded.
+class CaptureScheduler {
+public:
+    using Embedder = std::function<bool(const cv::Mat& face, std::vector<float>& out)>;
+
+    CaptureScheduler(CameraService& camera, int coalesce_ms);
+
+    CaptureScheduler(const CaptureScheduler&) = delete;
+    CaptureScheduler& operator=(const CaptureScheduler&) = delete;
+
+    // Call on_frame for each frame of the shared burst until it returns
+    // false, timeout_ms elapses or `cancel` fires. Returns the number of
+    // frames delivered. `embed` runs the model identified by `model`
+    // (its hash) and is used if this request leads the burst; a burst
+    // led with another model is waited out, never joined. Faces the
+    // helper dropped while this request was attached are added to
+    // `rejects`, if given.
+    int shared_burst(const Embedder& embed, uint64_t model,
+                     const std::function<bool(const BurstFrame&)>& on_frame,
+                     int timeout_ms, const CancelToken* cancel = nullptr,
+                     CaptureRejects* rejects = nullptr);
+
+    // Stream faces with the camera held exclusively. Time spent paused
+    // for auth does not count against timeout_ms, and the faces dropped
+    // meanwhile are the auth's, not passed to `on_rejects`. Returns
+    // faces delivered.
+    int exclusive_stream(const std::function<bool(CapturedFace&)>& on_face,
+                         int timeout_ms, const CancelToken* cancel = nullptr,
+                         const RejectSink& on_rejects = nullptr);
+
+    struct Stats {
+        uint64_t bursts;        // camera passes run for auth
+        uint64_t shared;        // auth requests that joined a running burst
+        uint64_t frames;        // faces embedded for bursts
+        uint64_t preemptions;   // exclusive streams paused for auth
+        uint64_t cancelled;     // requests that left because they were cancelled
+        uint64_t skipped;       // faces not embedded because nobody wanted them
+    };
+    Stats stats() const;
+
+private:
+    struct Burst {
+        uint64_t               model  = 0;   // hash of the embedding model
+        std::deque<BurstFrame> frames;   // references stay valid on push_back
+        CaptureRejects         rejects;  // faces the helper dropped so far
+        int                    active = 0;   // attached requests wanting frames
+        bool                   closed = false;
+    };
+
+    enum class Owner { None, Burst, Exclusive };
+
+    CameraService& camera_;
+    int            coalesce_ms_;
+
+    mutable std::mutex      mtx_;
+    std::condition_variable cv_;
+    Owner                   owner_ = Owner::None;
+    std::shared_ptr<Burst>  burst_;          // the open burst, if any
+    std::atomic<int>        auth_waiting_{0};
+
+    std::atomic<uint64_t> bursts_{0};
+    std::atomic<uint64_t> shared_{0};
+    std::atomic<uint64_t> frames_{0};
+    std::atomic<uint64_t> preemptions_{0};
+    std::atomic<uint64_t> cancelled_{0};
+    std::atomic<uint64_t> skipped_{0};
+
+    // cv_.wait_until that also gives up when `cancel` fires
+    template <class Pred>
+    bool wait_until(std::unique_lock<std::mutex>& lk,
+                    std::chrono::steady_clock::time_point deadline,
+                    const CancelToken* cancel, Pred ready);
+
+    void lead(const std::shared_ptr<Burst>& b, const Embedder& embed,
+              int timeout_ms, const std::function<void()>& consume);
+};
+
+} // namespace facelock
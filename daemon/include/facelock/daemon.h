@@ -1,22 +1,63 @@
 #pragma once
 #include <string>
 #include <memory>
+#include <functional>
 #include <nlohmann/json.hpp>
 
 namespace facelock {
 
 using json = nlohmann::json;
 
+class CancelToken;
+struct PeerCred;
+
 struct DaemonConfig {
+    std::string config_path     = "/etc/facelock/facelock.conf"; // re-read on reload
     std::string socket_path     = "/run/facelock/facelock.sock";
+    int         ipc_backlog     = 16;    // listen() backlog
+    int         ipc_workers     = 4;     // threads running requests
+    int         ipc_read_timeout_ms = 5000;  // a request must arrive within this
+    int         ipc_max_request = 65536; // bytes per request line
     std::string data_dir        = "/var/lib/facelock/";
     std::string onnx_model_path = "/usr/share/facelock/models/w600k_mbf.onnx";
     float       onnx_threshold  = 0.30f;
+    int         onnx_pool_size     = 2;  // concurrent inference sessions
+    int         onnx_intra_threads = 1;  // ORT intra-op threads per session
+    int         onnx_inter_threads = 1;  // ORT inter-op threads per session
+    std::string onnx_cache_dir  = "/var/cache/facelock"; // optimised graph cache, "" = off
     int         camera_device   = 0;
+    std::string camera_helper   = "/usr/lib/facelock/facelock-camera-helper";
+    std::string camera_backend  = "auto"; // auto | v4l2 | opencv
+    int         camera_idle_timeout = 60; // seconds before the helper releases the camera (0 = never)
+    int         capture_window  = 3;      // frames the helper compares before sending the best face
+    float       quality_min_confidence = 0.7f;  // helper drops faces below these...
+    float       quality_min_face       = 80.f;  // face width in frame pixels
+    float       quality_max_yaw        = 0.35f; // ...or turned / tilted past these
+    float       quality_max_pitch      = 0.25f;
+    float       quality_min_sharpness  = 30.f;  // Laplacian variance of the aligned crop
+    std::string gallery_dtype   = "f32";  // stored template type: f32 | f16 | i8
     int         enroll_target   = 20;   // desired number of enrollment samples
     int         enroll_min      = 10;   // minimum accepted
+    int         auth_burst_frames = 5;    // max faces embedded per auth request
+    int         auth_burst_ms     = 2000; // time budget for one auth burst
+    int         auth_burst_min    = 2;    // frames before the fused score may decide
+    float       auth_margin       = 0.08f; // distance from threshold that counts as "clear"
+    int         auth_coalesce_ms  = 300;   // frames this recent are shared with a joining auth
+    bool        adaptive_gallery  = false; // learn templates from confident auths
+    float       adaptive_margin   = 0.10f; // auth must be this far inside the threshold to teach
+    int         adaptive_max      = 20;    // learned templates kept per user
+    float       adaptive_min_dist = 0.03f; // skip templates this close to an existing one
+    int         identify_brute_max = 2000; // templates scored exhaustively before identify uses HNSW
+    int         identify_ef_search = 64;   // HNSW candidate list size for identify
+    bool        trace      = false;   // record per-stage spans (also toggled by "trace")
+    std::string trace_file = "/run/facelock/trace.json"; // SIGUSR1 dumps the spans here
 };
 
+// Parse a KEY=VALUE config file (# comments, blank lines ok) over the
+// compiled-in defaults; a missing file yields the defaults. Throws
+// std::exception on a malformed number.
+DaemonConfig load_config(const std::string& path);
+
 class Daemon {
 public:
     explicit Daemon(const DaemonConfig& cfg);
@@ -27,9 +68,16 @@ private:
     struct Impl;
     std::unique_ptr<Impl> pimpl_;
 
-    DaemonConfig cfg_;
+    // progress event for the client, sent ahead of the final reply
+    using Emit = std::function<void(const json&)>;
+
+    DaemonConfig cfg_;   // as started; requests use the current engine's copy
     bool initialize();
-    json handle_request(const json& req);
+    json handle_request(const json& req, const Emit& emit,
+                        const CancelToken& cancel, const PeerCred& peer);
+
+    // re-read the config file and swap in what changed (SIGHUP, "reload")
+    json reload(const char* trigger);
 };
 
 } // namespace facelock
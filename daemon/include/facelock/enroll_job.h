@@ -0,0 +1,125 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include <nlohmann/json.hpp>
+#include <opencv2/core.hpp>
+#include "facelock/camera_service.h"
+#include "facelock/cancel.h"
+
+namespace facelock {
+
+using json = nlohmann::json;
+
+// {"confidence": n, "size": n, "pose": n, ...} in replies and events
+inline void to_json(json& j, const CaptureRejects& r) {
+    j = json::object();
+    for (int i = 0; i < CAPTURE_REJECT_COUNT; ++i)
+        j[CAPTURE_REJECT_NAMES[i]] = r.count[i];
+}
+
+// One enrollment running in the background, as a pipeline of stages on
+// their own threads joined by bounded queues:
+//
+//   capture ──┬──▶ embed (batches)
+//             └──▶ persist (sample PNGs)
+//
+// Quality is checked in the camera helper, which only sends the best
+// face of each short window; the job counts the faces it rejects.
+// The camera keeps streaming while earlier faces are embedded and
+// written; a full queue slows the stage before it instead of growing.
+// Once every stage has drained, `finish` turns the embeddings into the
+// job's result (gallery write, audit) on the job thread.
+class EnrollJob {
+public:
+    struct Params {
+        int         target       = 20;      // accepted samples wanted
+        int         max_attempts = 60;      // faces looked at (sent or rejected) before giving up
+        int         timeout_ms   = 45000;   // camera time (pauses for auth excluded)
+        int         batch        = 8;       // largest embedding batch
+        int         queue        = 8;       // faces buffered between stages
+        std::string sample_dir;             // where sample PNGs go ("" = none)
+    };
+
+    struct Counts {
+        int            seen     = 0;   // faces the helper looked at and passed
+        int            accepted = 0;   // taken as samples
+        int            embedded = 0;   // samples with an embedding
+        int            written  = 0;   // sample PNGs on disk
+        CaptureRejects rejects;        // faces the helper dropped, by reason
+
+        int attempts() const { return seen + (int)rejects.total(); }
+    };
+
+    // stream faces to on_face until it returns false, passing the faces
+    // the helper dropped meanwhile to on_rejects (the scheduler's
+    // exclusive_stream)
+    using Capture    = std::function<int(const std::function<bool(CapturedFace&)>& on_face,
+                                         int timeout_ms, const CancelToken* cancel,
+                                         const RejectSink& on_rejects)>;
+    // one row per face, CV_32F; empty on failure
+    using EmbedBatch = std::function<cv::Mat(const std::vector<cv::Mat>& faces)>;
+    // embeddings are row-major, counts.embedded rows of `dim` floats
+    using Finish     = std::function<json(const std::vector<float>& embeddings, size_t dim,
+                                          const Counts& counts, bool cancelled)>;
+
+    struct Stages {
+        Capture    capture;
+        EmbedBatch embed;
+        Finish     finish;
+    };
+
+    EnrollJob(std::string id, std::string user, const Params& params, Stages stages);
+    ~EnrollJob();   // cancels and joins
+
+    EnrollJob(const EnrollJob&) = delete;
+    EnrollJob& operator=(const EnrollJob&) = delete;
+
+    void start();
+    void cancel() { cancel_.cancel(); stop_.cancel(); }
+
+    const std::string& id()   const { return id_; }
+    const std::string& user() const { return user_; }
+    bool done() const;
+
+    // how long ago the job finished; zero while it runs
+    std::chrono::steady_clock::duration finished_for() const;
+
+    // state, counters and, once finished, the result
+    json status() const;
+
+    // Block until the job finishes and return its result. on_progress is
+    // called with a "progress" event whenever the counters move. Returns
+    // null if `cancel` fires first; the job itself keeps running.
+    json wait(const std::function<void(const json&)>& on_progress,
+              const CancelToken* cancel = nullptr) const;
+
+private:
+    std::string id_;
+    std::string user_;
+    Params      params_;
+    Stages      stages_;
+    CancelToken cancel_;
+    CancelToken stop_;   // ends capture: cancel, or enough faces looked at
+
+    mutable std::mutex              mtx_;
+    mutable std::condition_variable cv_;
+    Counts   counts_;
+    uint64_t changes_ = 0;   // bumped with every counter update
+    bool     done_    = false;
+    json     result_;
+    std::chrono::steady_clock::time_point started_, finished_;
+
+    std::thread thread_;
+
+    void run();
+    void update(const std::function<void(Counts&)>& fn);
+    json progress_locked() const;
+};
+
+} // namespace facelock
@@ -0,0 +1,76 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <unordered_map>
+#include "facelock/storage.h"
+
+namespace facelock {
+
+// Enrolled galleries kept in memory. A user's file is read on the first
+// request for them; afterwards auth does no file I/O. Entries are dropped
+// when inotify sees the file change in DATA_DIR, or by invalidate() /
+// clear() after the daemon writes a gallery itself.
+class GalleryCache {
+public:
+    // model_hash: galleries enrolled with another model are rejected
+    // adaptive: append each user's learned templates (<user>.adapt)
+    GalleryCache(const std::string& data_dir, uint64_t model_hash,
+                 bool adaptive = false);
+    ~GalleryCache();
+
+    GalleryCache(const GalleryCache&) = delete;
+    GalleryCache& operator=(const GalleryCache&) = delete;
+
+    // cached or freshly loaded gallery; nullptr with `err` set to
+    // "not_enrolled", "model_mismatch" or "read_failed" otherwise
+    GalleryPtr get(const std::string& user, std::string* err = nullptr);
+
+    void invalidate(const std::string& user);
+    void clear();
+
+    // called after every invalidation, from the invalidating thread (the
+    // inotify watcher included); user is empty when everything was
+    // dropped. Set once, before the cache is shared.
+    using Listener = std::function<void(const std::string& user)>;
+    void set_listener(Listener l) { listener_ = std::move(l); }
+
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t invalidations;
+        size_t   cached;      // users currently held
+    };
+    Stats stats() const;
+
+private:
+    std::string data_dir_;
+    uint64_t    model_hash_;
+    bool        adaptive_;
+
+    struct Entry {
+        GalleryPtr  gallery;
+        std::string err;     // why gallery is null (not enrolled, other model)
+    };
+
+    mutable std::mutex                     mtx_;
+    std::unordered_map<std::string, Entry> entries_;
+    uint64_t                               generation_ = 0;
+    Listener                               listener_;
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> invalidations_{0};
+
+    int         inotify_fd_ = -1;
+    int         stop_fd_    = -1;   // eventfd that wakes the watcher on shutdown
+    std::thread watcher_;
+
+    void watch_loop();
+};
+
+} // namespace facelock
@@ -0,0 +1,96 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdint>
+#include <shared_mutex>
+#include <unordered_map>
+#include "facelock/storage.h"
+
+namespace facelock {
+
+// 1:N index over the templates of every enrolled user, for identify.
+//
+// Up to `brute_max` live templates a query is scored exactly against
+// every user (one contiguous SIMD pass per user). Beyond that an HNSW
+// graph (Malkov & Yashunin) proposes candidates and the few best users
+// are re-scored exactly, so the reported score always matches what
+// auth would compute for that user.
+//
+// set_user() replaces a user's templates incrementally: the old nodes
+// are tombstoned and the new ones linked into the graph. Storage is only
+// compacted once tombstones outnumber live templates.
+class IdentityIndex {
+public:
+    struct Params {
+        size_t brute_max       = 2000;  // live templates before the graph is used
+        int    M               = 16;    // graph degree (2*M on layer 0)
+        int    ef_construction = 100;
+        int    ef_search       = 64;
+    };
+
+    explicit IdentityIndex(const Params& p);
+
+    // add or replace all templates of `user` (converted to f32)
+    void set_user(const std::string& user, const Gallery& g);
+    void remove_user(const std::string& user);
+
+    struct Match {
+        std::string user;
+        float       score = 1.f;   // mean of the user's 3 best distances
+    };
+
+    // best-matching user for an L2-normalised query; false if empty
+    bool search(const float* query, size_t dim, Match& out) const;
+
+    size_t users()     const;
+    size_t templates() const;   // live
+    bool   graph()     const;   // HNSW active
+
+private:
+    struct User {
+        std::string name;
+        uint32_t    first = 0;   // node range [first, first + count)
+        uint32_t    count = 0;
+        bool        live  = false;
+    };
+
+    struct Node {
+        uint32_t                           owner;
+        bool                               deleted = false;
+        std::vector<std::vector<uint32_t>> links;   // per layer
+
+        explicit Node(uint32_t o) : owner(o) {}
+    };
+
+    Params params_;
+    size_t dim_ = 0;
+
+    mutable std::shared_mutex             mtx_;
+    std::vector<float>                    vecs_;    // node i at i * dim_
+    std::vector<Node>                     nodes_;
+    std::vector<User>                     users_;
+    std::unordered_map<std::string, uint32_t> user_ids_;
+    size_t                                live_    = 0;
+    size_t                                deleted_ = 0;
+
+    bool         graph_       = false;
+    uint32_t     entry_       = 0;
+    int          max_level_   = -1;
+    std::mt19937 rng_{0x46434C4Bu};
+
+    const float* vec(uint32_t i) const { return vecs_.data() + (size_t)i * dim_; }
+    float        distance(const float* q, uint32_t i) const;
+    float        user_score(const float* q, const User& u) const;
+
+    void drop_locked(uint32_t uid);
+    void compact_locked();
+    void build_graph_locked();
+    void link_locked(uint32_t id);
+
+    // best `ef` nodes reachable from `entry` on `layer`, ascending distance
+    std::vector<std::pair<float, uint32_t>>
+    search_layer(const float* q, uint32_t entry, size_t ef, int layer) const;
+};
+
+} // namespace facelock
@@ -0,0 +1,43 @@
+#pragma once
+// Wire format of the daemon socket, shared by the server and clients.
+//
+// Line mode: one JSON object per '\n'-terminated line.
+//   v1/v2 requests are answered once and the connection is closed.
+//   A request with "v":3 makes the connection persistent: further
+//   requests may be sent without waiting for answers (pipelining). Each
+//   response carries the request's "id" and they arrive in completion
+//   order, not request order. A long request may send progress events,
+//   {"v":3,"id":..,"event":"<name>",...}, before its final response;
+//   only the final response has an "ok" field.
+//
+// Binary mode (v3 only): a connection whose first byte is
+// IPC_FRAME_MAGIC0 carries length-prefixed frames both ways,
+//   [ IpcFrameHeader, 8 bytes ][ payload, `length` bytes ]
+// with a JSON text or CBOR (RFC 8949) payload. Responses use the
+// format of the request they answer.
+#include <cstdint>
+
+namespace facelock {
+
+constexpr int IPC_VERSION = 3;
+
+constexpr uint8_t IPC_FRAME_MAGIC0 = 'F';
+constexpr uint8_t IPC_FRAME_MAGIC1 = 'L';
+
+enum IpcFormat : uint8_t {
+    IPC_FORMAT_JSON = 1,
+    IPC_FORMAT_CBOR = 2,
+};
+
+#pragma pack(push, 1)
+struct IpcFrameHeader {
+    uint8_t  magic[2];   // IPC_FRAME_MAGIC0, IPC_FRAME_MAGIC1
+    uint8_t  format;     // IpcFormat
+    uint8_t  flags;      // reserved, 0
+    uint32_t length;     // payload bytes, little-endian
+};
+#pragma pack(pop)
+
+static_assert(sizeof(IpcFrameHeader) == 8, "ipc frame header layout changed");
+
+} // namespace facelock
@@ -1,34 +1,137 @@
 #pragma once
 #include <string>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
 #include <functional>
+#include <unordered_map>
+#include <sys/types.h>
 #include <nlohmann/json.hpp>
+#include "facelock/cancel.h"
 
 namespace facelock {
 
 using json = nlohmann::json;
 
-// Simple JSON-over-UDS server. Accepts single JSON request per connection and returns JSON.
+class WorkerPool;
+
+// Who is on the other end of a connection (SO_PEERCRED, taken at
+// accept). uid is -1 if the kernel would not tell; treat as unprivileged.
+struct PeerCred {
+    uid_t uid = (uid_t)-1;
+    pid_t pid = -1;
+};
+
+struct IPCOptions {
+    int    backlog         = 16;         // listen() backlog
+    size_t workers         = 4;          // threads running handlers
+    size_t max_queue       = 32;         // requests waiting for a worker
+    size_t max_connections = 64;         // open connections before accept sheds
+    size_t max_inflight    = 16;         // pipelined requests per connection
+    int    read_timeout_ms = 5000;       // a started request must complete within this
+    int    idle_timeout_ms = 300000;     // idle persistent (v3) connections are closed
+    size_t max_request     = 64 * 1024;  // bytes per request
+    int    listen_fd       = -1;         // inherited listening socket (systemd), -1 = bind
+};
+
+// JSON / CBOR over a Unix socket; framing is described in ipc_protocol.h.
+// A single epoll thread owns every socket (non-blocking accept, read,
+// write and deadlines); complete requests run on a bounded worker pool,
+// so a slow auth never holds up other clients or other requests
+// pipelined on the same connection.
 class IPCServer {
 public:
-    using Handler = std::function<json(const json&)>;
+    // Sends a progress event ahead of the final reply. Events reach v3
+    // clients tagged with the request's id; for v1/v2 clients, which get
+    // exactly one answer per connection, they are dropped.
+    using Emit    = std::function<void(const json& event)>;
+    // `cancel` fires when the client disconnects with the request still
+    // in flight; the reply would be dropped, so the handler may stop early.
+    // `peer` is the connecting process, for requests only some may make.
+    using Handler = std::function<json(const json& req, const Emit& emit,
+                                       const CancelToken& cancel,
+                                       const PeerCred& peer)>;
 
-    explicit IPCServer(const std::string& socket_path);
+    explicit IPCServer(const std::string& socket_path,
+                       const IPCOptions& opts = IPCOptions());
     ~IPCServer();
 
-    // start listening and spawn accept thread. returns true on success.
+    // bind, listen and start the event loop. returns true on success.
     bool start(const Handler& handler);
     void stop();
 
 private:
+    enum class Framing { Unknown, Line, Binary };
+
+    struct Message {
+        uint8_t     format;    // IpcFormat
+        bool        framed;    // binary mode
+        std::string payload;
+    };
+
+    struct Reply {
+        std::string bytes;         // framed, ready to send
+        bool        v3;            // keeps a line-mode connection open
+        bool        final = true;  // false for progress events
+    };
+
+    struct Conn {
+        int         fd;
+        Framing     framing     = Framing::Unknown;
+        uint8_t     format      = 1;       // of the last request, for errors
+        std::string in;
+        std::string out;
+        size_t      sent        = 0;
+        int         inflight    = 0;
+        bool        persistent  = false;   // a v3 request was answered
+        bool        closing     = false;   // close once work and output drain
+        uint32_t    events      = 0;       // registered with epoll
+        int64_t     partial_ms  = 0;       // first byte of the pending request
+        int64_t     active_ms   = 0;       // last read / write / reply
+        PeerCred    peer;
+        std::shared_ptr<CancelToken> cancel;  // shared with requests in flight
+    };
+
     std::string socket_path_;
-    int server_fd_ = -1;
-    bool running_ = false;
+    IPCOptions  opts_;
+    Handler     handler_;
+
+    int  server_fd_ = -1;
+    int  epoll_fd_  = -1;
+    int  wake_fd_   = -1;   // eventfd: stop request or finished replies
+    bool running_   = false;
+    bool inherited_ = false;   // listen_fd from systemd: never unlinked
+
+    std::thread                        loop_;
+    std::unique_ptr<WorkerPool>        pool_;
+    std::unordered_map<uint64_t, Conn> conns_;   // event loop thread only
+    uint64_t                           next_id_ = 2;   // 0, 1: listen fd, wake fd
+
+    // replies handed back from workers to the loop
+    std::mutex                               done_mtx_;
+    std::vector<std::pair<uint64_t, Reply>>  done_;
+    bool                                     stopping_ = false;
 
-    // accept loop runs in a detached thread
-    void accept_loop(Handler handler);
+    void event_loop();
+    void on_accept();
+    void on_readable(uint64_t id, Conn& c);
+    bool flush(uint64_t id, Conn& c);
+    bool next_message(Conn& c, Message& m, const char*& err);
+    bool has_message(const Conn& c) const;
+    void dispatch(uint64_t id, Conn& c, Message m);
+    void fail(uint64_t id, Conn& c, const char* err, const char* hint,
+              bool close_after);
+    void post(uint64_t id, Reply r);
+    void collect_done();
+    void update_events(uint64_t id, Conn& c);
+    int64_t deadline(const Conn& c) const;
+    void expire(int64_t now_ms);
+    void close_conn(uint64_t id);
 
-    // helpers
-    static std::string trim(const std::string &s);
+    Reply handle(uint64_t id, const Message& m, const CancelToken& cancel,
+                 const PeerCred& peer, const char* reject);
 };
 
 } // namespace facelock
@@ -2,25 +2,59 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include <utility>
+#include <cstdint>
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/imgcodecs.hpp>
 
 namespace facelock {
 
+// Per-session ORT knobs
+struct ONNXOptions {
+    int intra_op_threads = 1;
+    int inter_op_threads = 1;
+
+    // directory for the optimised-graph cache; empty disables it
+    std::string cache_dir;
+};
+
 class ONNXWrapper {
 public:
     // model_path: path to ONNX file
     // providers: optional provider list (e.g., {"CPUExecutionProvider"})
     ONNXWrapper(const std::string& model_path,
-                const std::vector<std::string>& providers = {});
+                const std::vector<std::string>& providers = {},
+                const ONNXOptions& opts = {});
     ~ONNXWrapper();
 
     // compute normalized embedding for a BGR image crop
     // typical use: face recognition embedding nets
     std::vector<float> embed(const cv::Mat& bgr_crop);
 
+    // same as embed(), but writes the normalised embedding into the
+    // caller's buffer using preallocated, pre-bound ORT tensors: no heap
+    // allocation once warm. Returns false if out_len < embedding_dim() or
+    // the model's output shape is dynamic (use embed() then).
+    bool embed_into(const cv::Mat& bgr_crop, float* out, size_t out_len);
+
+    // output size of the bound path, 0 if unavailable
+    size_t embedding_dim() const;
+
+    // identity of the model file (hash of its bytes), 0 if unknown;
+    // stamped into galleries so templates are never mixed across models
+    uint64_t model_hash() const;
+
+    // embed several crops with as few Session::Run calls as the model
+    // allows: one NCHW tensor per call when the batch dimension is
+    // dynamic, fixed-size chunks otherwise. Returns an N x D CV_32F matrix
+    // of L2-normalised rows (contiguous), empty for empty input.
+    cv::Mat embed_batch(const std::vector<cv::Mat>& bgr_crops);
+
     // run model and return raw float output (first output) — useful for landmark models
     std::vector<float> run_raw(const cv::Mat& bgr_input);
 
@@ -31,6 +65,13 @@ public:
     std::pair<int,int> input_size() const { return input_size_; }
 
 private:
+    friend class ONNXSessionPool;
+
+    // state shared by every session of a pool (prepacked weights)
+    struct Shared;
+    ONNXWrapper(const std::string& model_path, const ONNXOptions& opts,
+                const std::shared_ptr<Shared>& shared);
+
     struct Impl;
     Impl* pimpl_;
 
@@ -38,4 +79,52 @@ private:
     std::pair<int,int> input_size_ = {112,112};
 };
 
+// Fixed set of sessions over one model. All sessions share the process
+// Ort::Env and, where ORT supports it, one copy of the prepacked weights,
+// so concurrent requests run in parallel instead of queueing on a mutex.
+class ONNXSessionPool {
+public:
+    ONNXSessionPool(const std::string& model_path, size_t size,
+                    const ONNXOptions& opts = {});
+    ~ONNXSessionPool();
+
+    // RAII checkout of one session; returned to the pool on destruction
+    class Lease {
+    public:
+        Lease(Lease&& o) noexcept : pool_(o.pool_), idx_(o.idx_) { o.pool_ = nullptr; }
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        ~Lease() { if (pool_) pool_->release(idx_); }
+
+        ONNXWrapper* operator->() const { return pool_->sessions_[idx_].get(); }
+        ONNXWrapper& operator*()  const { return *pool_->sessions_[idx_]; }
+
+    private:
+        friend class ONNXSessionPool;
+        Lease(ONNXSessionPool* p, size_t i) : pool_(p), idx_(i) {}
+        ONNXSessionPool* pool_;
+        size_t           idx_;
+    };
+
+    // Grab a free session with a lock-free scan; only waits when every
+    // session is busy.
+    Lease acquire();
+
+    size_t size() const { return sessions_.size(); }
+
+    uint64_t model_hash() const { return sessions_[0]->model_hash(); }
+
+    // run `runs` warmup inferences on every session
+    void warmup(const cv::Mat& sample, int runs = 2);
+
+private:
+    std::vector<std::unique_ptr<ONNXWrapper>> sessions_;
+    std::unique_ptr<std::atomic<bool>[]>      busy_;
+    std::mutex                                wait_mtx_;
+    std::condition_variable                   wait_cv_;
+
+    bool try_acquire(size_t& idx);
+    void release(size_t idx);
+};
+
 } // namespace facelock
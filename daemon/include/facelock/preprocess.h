@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace facelock {
+
+// Fused embedding-net preprocessing: 8-bit BGR (HWC, `stride` bytes per
+// row) → float planar RGB (CHW) scaled to [0,1]. Replaces the
+// cvtColor + convertTo + hwc_to_chw passes with a single sweep.
+// The SIMD variant (AVX2 / SSE4.1 / NEON) is chosen once at runtime.
+void bgr_to_planar_rgb(const uint8_t* bgr, size_t stride,
+                       int width, int height, float* out);
+
+// portable reference implementation, also the fallback kernel
+void bgr_to_planar_rgb_scalar(const uint8_t* bgr, size_t stride,
+                              int width, int height, float* out);
+
+// name of the kernel bgr_to_planar_rgb dispatches to ("avx2", "sse4.1",
+// "neon" or "scalar")
+const char* preprocess_kernel_name();
+
+} // namespace facelock
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace facelock {
+
+// Similarity kernels for L2-normalised embeddings. Both the query and the
+// stored templates are normalised when they are produced, so cosine
+// similarity is a plain dot product; nothing here recomputes norms.
+// The SIMD variant (AVX-512 / AVX2+FMA / NEON) is chosen once at runtime,
+// with the 512-dim case specialised at compile time.
+
+float dot(const float* a, const float* b, size_t dim);
+
+// out[i] = dot(query, rows + i * dim) for an n x dim row-major matrix
+void dot_rows(const float* query, const float* rows,
+              size_t n, size_t dim, float* out);
+
+// portable reference implementation, also the fallback kernel
+void dot_rows_scalar(const float* query, const float* rows,
+                     size_t n, size_t dim, float* out);
+
+// The k smallest cosine distances (1 - dot) of query against the rows,
+// ascending, in out[0 .. min(k, n)). Partial selection, no full sort
+// and no heap allocation; meant for small k. Returns the count written.
+size_t top_k_distances(const float* query, const float* rows,
+                       size_t n, size_t dim, size_t k, float* out);
+
+// ------------------------------------------------------------
+//  Quantised templates
+// ------------------------------------------------------------
+enum TemplateType : uint16_t {
+    TEMPLATE_F32 = 0,
+    TEMPLATE_F16 = 1,   // IEEE half, stored as uint16_t
+    TEMPLATE_I8  = 2,   // symmetric int8, one float scale per row
+};
+
+// Read-only view of n templates of `dim` values, rows back to back.
+// For TEMPLATE_I8, value[i] ~= rows[i] * scales[row].
+struct TemplateMatrix {
+    TemplateType type   = TEMPLATE_F32;
+    const void*  rows   = nullptr;
+    const float* scales = nullptr;
+    size_t       n      = 0;
+    size_t       dim    = 0;
+};
+
+uint16_t float_to_half(float f);
+float    half_to_float(uint16_t h);
+
+// Quantise v to int8 in [-127, 127]; returns the scale (max|v| / 127)
+float quantize_i8(const float* v, size_t dim, int8_t* out);
+
+// out[i] = dot(query, row i) with rows converted on the fly
+void dot_rows_f16(const float* query, const uint16_t* rows,
+                  size_t n, size_t dim, float* out);
+
+// Integer dot products of an int8 query (scale qscale) against int8 rows,
+// rescaled to float. Uses AVX-512 VNNI (vpdpbusd) where available.
+void dot_rows_i8(const int8_t* query, float qscale,
+                 const int8_t* rows, const float* scales,
+                 size_t n, size_t dim, float* out);
+
+// top_k_distances over any template type. An I8 matrix quantises the
+// query once on the stack (dim <= 4096).
+size_t top_k_distances(const float* query, const TemplateMatrix& m,
+                       size_t k, float* out);
+
+// name of the kernels in use, e.g. "avx512" or "avx2" for float, with
+// the int8 path appended when it differs ("avx512+vnni")
+const char* similarity_kernel_name();
+
+} // namespace facelock
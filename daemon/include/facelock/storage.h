@@ -1,13 +1,207 @@
 #pragma once
 #include <string>
+#include <memory>
 #include <vector>
+#include <cstdint>
+#include "facelock/similarity.h"
 
 namespace facelock {
 
-// Storage interface: persist/load embeddings or raw training data.
-// In production this should use encrypted storage (SQLCipher or similar).
-bool save_embeddings(const std::string& data_dir, const std::string& user, const std::vector<std::vector<float>>& embs);
-std::vector<std::vector<float>> load_embeddings(const std::string& data_dir, const std::string& user);
+// ============================================================
+//  On-disk gallery format (<user>.gallery)
+//
+//  [ GalleryHeader, 64 bytes ][ N x row_stride bytes of templates ]
+//  int8 galleries follow the matrix with N float row scales, starting
+//  at the next 64-byte boundary; data_bytes covers both.
+//
+//  The matrix starts at data_offset (a multiple of 64) so an mmap of
+//  the file is handed to the scorer as-is. header_crc covers the
+//  header up to that field, data_crc the data (zlib crc32).
+//  In production this should additionally use encrypted storage.
+// ============================================================
+constexpr uint32_t GALLERY_MAGIC   = 0x41474C46u;   // "FLGA" little-endian
+constexpr uint16_t GALLERY_VERSION = 1;
 
-} // namespace facelock
+// same values as TemplateType, so a mapped file is a TemplateMatrix
+enum GalleryDType : uint16_t {
+    GALLERY_F32 = TEMPLATE_F32,
+    GALLERY_F16 = TEMPLATE_F16,   // ~2x smaller, negligible score drift
+    GALLERY_I8  = TEMPLATE_I8,    // ~4x smaller, per-template scale
+};
+
+// "f32" | "f16" | "i8"
+bool parse_gallery_dtype(const std::string& name, GalleryDType& out);
+const char* gallery_dtype_name(GalleryDType t);
+
+#pragma pack(push, 1)
+struct GalleryHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t dtype;         // GalleryDType
+    uint32_t count;         // N templates
+    uint32_t dim;           // D values per template
+    uint64_t model_hash;    // embedding model the templates came from
+    uint64_t data_offset;   // start of the matrix, 64-byte aligned
+    uint64_t data_bytes;    // N * row_stride
+    uint32_t row_stride;    // bytes per template
+    uint32_t data_crc;
+    uint32_t header_crc;    // crc32 of every byte before this field
+    uint8_t  reserved[12];
+};
+#pragma pack(pop)
+
+static_assert(sizeof(GalleryHeader) == 64, "gallery header layout changed");
+
+// One user's enrolled templates: N x D values (f32, f16 or int8),
+// row-major and contiguous from a 64-byte aligned base. Read-only;
+// backed either by an mmap of the gallery file or by a heap block.
+class Gallery {
+public:
+    Gallery(uint32_t n, uint32_t dim, uint64_t model_hash, GalleryDType dtype,
+            const void* rows, const float* scales,
+            std::shared_ptr<const void> storage)
+        : n_(n), dim_(dim), model_hash_(model_hash), dtype_(dtype),
+          rows_(rows), scales_(scales), storage_(std::move(storage)) {}
+
+    uint32_t     size()       const { return n_; }
+    uint32_t     dim()        const { return dim_; }
+    uint64_t     model_hash() const { return model_hash_; }
+    GalleryDType dtype()      const { return dtype_; }
+
+    const void*  rows()   const { return rows_; }
+    const float* scales() const { return scales_; }   // int8 only
+
+    TemplateMatrix matrix() const {
+        TemplateMatrix m;
+        m.type   = (TemplateType)dtype_;
+        m.rows   = rows_;
+        m.scales = scales_;
+        m.n      = n_;
+        m.dim    = dim_;
+        return m;
+    }
+
+private:
+    uint32_t                    n_;
+    uint32_t                    dim_;
+    uint64_t                    model_hash_;
+    GalleryDType                dtype_;
+    const void*                 rows_;
+    const float*                scales_;
+    std::shared_ptr<const void> storage_;   // keeps the mapping / block alive
+};
+
+using GalleryPtr = std::shared_ptr<const Gallery>;
+
+// file name suffix of a gallery inside DATA_DIR
+extern const char* const GALLERY_SUFFIX;
+
+std::string gallery_path(const std::string& data_dir, const std::string& user);
+
+// users with a gallery (or a pre-v2.2 file still to migrate) in data_dir
+std::vector<std::string> list_galleries(const std::string& data_dir);
+
+// Write n x dim L2-normalised float templates, converted to `dtype`.
+// Atomic: written to a temp file, fsync'd and renamed over the old
+// gallery, so a crash leaves either the old or the new file, never a
+// torn one.
+bool save_gallery(const std::string& data_dir, const std::string& user,
+                  const float* rows, uint32_t n, uint32_t dim,
+                  uint64_t model_hash, GalleryDType dtype = GALLERY_F32);
+
+// mmap and validate a user's gallery. model_hash = 0 skips the model
+// check. On failure returns nullptr with err = "not_enrolled",
+// "read_failed" or "model_mismatch".
+// A pre-v2.2 <user>_onnx_emb.bin is converted on first load (stamped
+// with model_hash) and kept as <user>_onnx_emb.bin.migrated.
+GalleryPtr load_gallery(const std::string& data_dir, const std::string& user,
+                        uint64_t model_hash, std::string& err);
 
+// ============================================================
+//  Adaptive templates (<user>.adapt)
+//
+//  Append-only log of templates learned from confident auths. The
+//  enrolled <user>.gallery is never touched, so removing the log rolls
+//  the user back to their original enrollment.
+//
+//  [ AdaptFileHeader, 32 bytes ][ AdaptRecord (+ payload) ]...
+//  ADD records carry one f32 template; DROP records retire an earlier
+//  ADD by sequence number and have no payload. Records are only ever
+//  appended; a torn record at the tail (crash mid-append) is ignored
+//  and overwritten by the next append.
+// ============================================================
+constexpr uint32_t ADAPT_MAGIC   = 0x44414C46u;   // "FLAD" little-endian
+constexpr uint16_t ADAPT_VERSION = 1;
+
+enum AdaptOp : uint8_t {
+    ADAPT_ADD  = 1,
+    ADAPT_DROP = 2,
+};
+
+#pragma pack(push, 1)
+struct AdaptFileHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved0;
+    uint32_t dim;
+    uint64_t model_hash;
+    uint32_t header_crc;    // crc32 of every byte before this field
+    uint8_t  reserved[8];
+};
+
+struct AdaptRecord {
+    uint8_t  op;            // AdaptOp
+    uint8_t  reserved[3];
+    uint32_t seq;           // ADD: its sequence number; DROP: the ADD retired
+    uint64_t time;          // unix seconds
+    float    score;         // ADD: auth distance that admitted the template
+    uint32_t crc;           // crc32 of the fields above plus the payload
+};
+#pragma pack(pop)
+
+static_assert(sizeof(AdaptFileHeader) == 32, "adapt header layout changed");
+static_assert(sizeof(AdaptRecord) == 24, "adapt record layout changed");
+
+struct AdaptiveTemplate {
+    uint32_t           seq   = 0;
+    uint64_t           time  = 0;
+    float              score = 0.f;
+    std::vector<float> row;
+};
+
+// Replayed state of a user's log
+struct AdaptiveLog {
+    uint32_t                      dim         = 0;
+    uint64_t                      model_hash  = 0;
+    std::vector<AdaptiveTemplate> live;              // oldest first
+    uint32_t                      next_seq    = 1;
+    uint32_t                      records     = 0;   // valid records, retired included
+    uint64_t                      valid_bytes = 0;   // 0 = no file yet
+};
+
+extern const char* const ADAPT_SUFFIX;
+
+std::string adaptive_path(const std::string& data_dir, const std::string& user);
+
+// Replay a user's log. False when there is none or it cannot be used
+// (corrupt header, other model); `out` is then empty.
+bool read_adaptive(const std::string& data_dir, const std::string& user,
+                   uint64_t model_hash, AdaptiveLog& out);
+
+// Append an ADD of `row` (log.dim floats), preceded by a DROP of
+// drop_seq unless it is 0, and fsync. `log` comes from read_adaptive,
+// or has only dim / model_hash set for a new file, and is updated in
+// place. Once retired records dominate, the log is rewritten with just
+// the live templates instead.
+bool append_adaptive(const std::string& data_dir, const std::string& user,
+                     AdaptiveLog& log, const float* row, float score,
+                     uint32_t drop_seq);
+
+// roll back to the enrolled gallery; true if a log was removed
+bool remove_adaptive(const std::string& data_dir, const std::string& user);
+
+// base's templates followed by the live adaptive ones, converted to
+// base's dtype, in a heap block
+GalleryPtr merge_adaptive(const Gallery& base, const AdaptiveLog& log);
+
+} // namespace facelock
@@ -0,0 +1,16 @@
+#pragma once
+#include <string>
+
+namespace facelock {
+
+// Minimal sd_notify(3): send `state` (e.g. "READY=1\nSTATUS=...") to the
+// socket in $NOTIFY_SOCKET. Returns false when not running under a
+// Type=notify unit or the send failed; callers treat that as a no-op.
+bool sd_notify_state(const std::string& state);
+
+// Minimal sd_listen_fds(3) for one socket: the listening fd handed over
+// by a .socket unit, or -1 when the daemon was not socket-activated.
+// Clears LISTEN_PID / LISTEN_FDS either way; call before starting threads.
+int sd_listen_fd();
+
+} // namespace facelock
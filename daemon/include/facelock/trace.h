@@ -0,0 +1,71 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+
+namespace facelock {
+
+using json = nlohmann::json;
+
+// Latency tracing for the request hot path. Spans are written to a
+// fixed ring per thread (single writer, no locks) and dumped on demand
+// as Chrome trace / Perfetto JSON; each ring keeps its newest
+// TRACE_RING_EVENTS spans. While tracing is off a span costs one
+// relaxed load.
+//
+// Timestamps are CLOCK_MONOTONIC (steady_clock), the same clock the
+// camera helper stamps frames with.
+constexpr size_t TRACE_RING_EVENTS = 2048;   // per thread, power of two
+constexpr size_t TRACE_MAX_RINGS   = 32;     // threads traced at once
+
+// nanoseconds on the trace clock
+uint64_t trace_now();
+
+namespace trace_detail {
+extern std::atomic<bool> enabled;
+void record(const char* name, uint64_t start_ns, uint64_t end_ns,
+            int pid = 0, int tid = 0);
+} // namespace trace_detail
+
+inline bool trace_enabled() {
+    return trace_detail::enabled.load(std::memory_order_relaxed);
+}
+void trace_enable(bool on);
+
+// One span from construction to destruction. `name` is kept by pointer,
+// so it must be a string literal.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name)
+        : name_(trace_enabled() ? name : nullptr),
+          start_(name_ ? trace_now() : 0) {}
+    ~TraceSpan() {
+        if (name_) trace_detail::record(name_, start_, trace_now());
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name_;
+    uint64_t    start_;
+};
+
+// A span timed somewhere else, e.g. by the camera helper: it is shown
+// on the track of process `pid` / thread `tid` (0 = the calling one).
+inline void trace_span(const char* name, uint64_t start_ns, uint64_t end_ns,
+                       int pid = 0, int tid = 0) {
+    if (trace_enabled()) trace_detail::record(name, start_ns, end_ns, pid, tid);
+}
+
+// label for the track of another process that spans are recorded for
+void trace_process_name(int pid, const std::string& name);
+
+// every ring's spans, oldest first, as {"traceEvents": [...]}
+json trace_dump();
+
+// trace_dump() to `path`, replaced atomically; false on a write error
+bool trace_write(const std::string& path);
+
+} // namespace facelock
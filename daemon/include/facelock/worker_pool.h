@@ -0,0 +1,40 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+namespace facelock {
+
+// Fixed set of threads draining a bounded FIFO of jobs. submit() never
+// blocks: when `max_queue` jobs are already waiting it refuses, so the
+// caller can shed load instead of queueing without limit.
+class WorkerPool {
+public:
+    using Job = std::function<void()>;
+
+    WorkerPool(size_t threads, size_t max_queue);
+    ~WorkerPool();   // runs the jobs already queued, then joins
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    bool submit(Job job);
+
+    size_t threads() const { return threads_.size(); }
+    size_t queued()  const;
+
+private:
+    size_t                   max_queue_;
+    mutable std::mutex       mtx_;
+    std::condition_variable  cv_;
+    std::deque<Job>          jobs_;
+    bool                     stopping_ = false;
+    std::vector<std::thread> threads_;
+
+    void run();
+};
+
+} // namespace facelock
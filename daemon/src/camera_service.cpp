@@ -0,0 +1,331 @@
+#include "facelock/camera_service.h"
+#include "facelock/trace.h"
+
+#include <sys/wait.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include <cerrno>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <spdlog/spdlog.h>
+
+using namespace facelock;
+using Clock = std::chrono::steady_clock;
+
+// Largest payload we accept from the helper (gray200 / bgr112 fit easily)
+static constexpr uint32_t MAX_PAYLOAD = 256 * 256 * 3;
+
+// How often stream() checks its interrupt while waiting for a face
+static constexpr int INTERRUPT_POLL_MS = 100;
+
+// Helper startup = camera open + detector load + warmup frames
+static constexpr auto SPAWN_TIMEOUT = std::chrono::seconds(10);
+
+CameraService::CameraService(const std::string& helper_path,
+                             int camera_device, int idle_timeout_sec,
+                             const std::string& backend,
+                             const CaptureQuality& quality)
+    : helper_path_(helper_path),
+      camera_device_(camera_device),
+      idle_timeout_sec_(idle_timeout_sec),
+      backend_(backend),
+      quality_(quality),
+      last_used_(Clock::now())
+{
+    if (idle_timeout_sec_ > 0)
+        idle_thread_ = std::thread(&CameraService::idle_loop, this);
+}
+
+CameraService::~CameraService() { stop(); }
+
+void CameraService::stop() {
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (!running_) return;
+        running_ = false;
+        kill_locked();
+    }
+    idle_cv_.notify_all();
+    if (idle_thread_.joinable()) idle_thread_.join();
+}
+
+CaptureRejects CameraService::rejects() const {
+    CaptureRejects r;
+    for (int i = 0; i < CAPTURE_REJECT_COUNT; ++i)
+        r.count[i] = rejects_[i].load(std::memory_order_relaxed);
+    return r;
+}
+
+bool CameraService::capture(CapturedFace& out, int timeout_ms) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (!running_) return false;
+    last_used_ = Clock::now();
+
+    // A helper that died since the last request shows up as a failed
+    // write/read here; respawn once and retry before giving up.
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (!ensure_running_locked())
+            return false;
+        if (request_locked(out, timeout_ms))
+            return true;
+        if (pid_ > 0) return false;   // helper alive, just no face
+    }
+    return false;
+}
+
+int CameraService::stream(const std::function<bool(CapturedFace&)>& on_face,
+                          int timeout_ms, const std::function<bool()>& interrupt,
+                          const RejectSink& on_rejects) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (!running_ || !ensure_running_locked()) return 0;
+    last_used_ = Clock::now();
+
+    const char start = CAPTURE_CMD_START;
+    if (write(to_helper_, &start, 1) != 1) {
+        kill_locked();
+        return 0;
+    }
+
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    int delivered = 0;
+    bool more = true;
+    while (more) {
+        // only start a record once it is there, so an interrupt never
+        // lands in the middle of one
+        if (interrupt) {
+            if (interrupt()) break;
+            if (!wait_readable(INTERRUPT_POLL_MS)) {
+                if (Clock::now() >= deadline) break;
+                continue;
+            }
+        }
+        CaptureRecordHeader hdr;
+        CapturedFace face;
+        if (!read_record(hdr, face, deadline, on_rejects)) break;
+        if (hdr.status != CAPTURE_OK) continue;
+        ++delivered;
+        more = on_face(face);
+    }
+
+    // Pause the helper and drain whatever it emitted in the meantime, up
+    // to the END marker, so the next request starts on a clean stream.
+    const char pause = CAPTURE_CMD_PAUSE;
+    bool synced = write(to_helper_, &pause, 1) == 1;
+    auto drain_deadline = Clock::now() + std::chrono::seconds(2);
+    while (synced) {
+        CaptureRecordHeader hdr;
+        CapturedFace face;
+        if (!read_record(hdr, face, drain_deadline, on_rejects)) { synced = false; break; }
+        if (hdr.status == CAPTURE_END) break;
+    }
+    if (!synced) kill_locked();
+
+    last_used_ = Clock::now();
+    return delivered;
+}
+
+// ------------------------------------------------------------
+//  Helper process lifecycle
+// ------------------------------------------------------------
+bool CameraService::ensure_running_locked() {
+    return pid_ > 0 || spawn_locked();
+}
+
+bool CameraService::spawn_locked() {
+    TraceSpan span("camera.spawn");   // exec, camera open, detector load, warmup
+    int in_pipe[2], out_pipe[2];
+    if (pipe2(in_pipe, O_CLOEXEC) < 0) return false;
+    if (pipe2(out_pipe, O_CLOEXEC) < 0) {
+        close(in_pipe[0]); close(in_pipe[1]);
+        return false;
+    }
+
+    std::vector<std::string> args = {
+        helper_path_, "--serve", "--mode", "bgr112",
+        "--camera",         std::to_string(camera_device_),
+        "--backend",        backend_,
+        "--window",         std::to_string(quality_.window),
+        "--min-confidence", std::to_string(quality_.min_confidence),
+        "--min-face",       std::to_string(quality_.min_face),
+        "--max-yaw",        std::to_string(quality_.max_yaw),
+        "--max-pitch",      std::to_string(quality_.max_pitch),
+        "--min-sharpness",  std::to_string(quality_.min_sharpness),
+    };
+    std::vector<const char*> argv;
+    for (const auto& a : args) argv.push_back(a.c_str());
+    argv.push_back(nullptr);
+    long max_fd = sysconf(_SC_OPEN_MAX);
+    if (max_fd < 0) max_fd = 1024;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(in_pipe[0]); close(in_pipe[1]);
+        close(out_pipe[0]); close(out_pipe[1]);
+        return false;
+    }
+
+    if (pid == 0) {
+        // child: only stdin/stdout pipes and inherited stderr survive exec
+        dup2(in_pipe[0], STDIN_FILENO);
+        dup2(out_pipe[1], STDOUT_FILENO);
+        for (long fd = STDERR_FILENO + 1; fd < max_fd; ++fd) close((int)fd);
+        execv(argv[0], const_cast<char* const*>(argv.data()));
+        _exit(127);
+    }
+
+    close(in_pipe[0]);
+    close(out_pipe[1]);
+    pid_         = pid;
+    to_helper_   = in_pipe[1];
+    from_helper_ = out_pipe[0];
+
+    char ready = 0;
+    if (!read_full(&ready, 1, Clock::now() + SPAWN_TIMEOUT) ||
+        ready != CAPTURE_READY) {
+        spdlog::error("Camera helper failed to start (/dev/video{})",
+                      camera_device_);
+        kill_locked();
+        return false;
+    }
+
+    spdlog::info("Camera helper started (pid {}, /dev/video{})",
+                 pid_, camera_device_);
+    trace_process_name(pid_, "facelock-camera-helper");
+    return true;
+}
+
+void CameraService::kill_locked() {
+    if (to_helper_ >= 0)   { close(to_helper_);   to_helper_   = -1; }
+    if (from_helper_ >= 0) { close(from_helper_); from_helper_ = -1; }
+    if (pid_ <= 0) return;
+
+    // EOF on stdin asks the helper to exit; give it a moment to release
+    // the device cleanly before forcing it.
+    auto deadline = Clock::now() + std::chrono::milliseconds(500);
+    while (waitpid(pid_, nullptr, WNOHANG) == 0) {
+        if (Clock::now() > deadline) {
+            kill(pid_, SIGKILL);
+            waitpid(pid_, nullptr, 0);
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    pid_ = -1;
+}
+
+void CameraService::idle_loop() {
+    std::unique_lock<std::mutex> lk(mtx_);
+    while (running_) {
+        idle_cv_.wait_for(lk, std::chrono::seconds(1));
+        if (pid_ > 0 &&
+            Clock::now() - last_used_ > std::chrono::seconds(idle_timeout_sec_)) {
+            spdlog::info("Camera idle for {}s, releasing device", idle_timeout_sec_);
+            kill_locked();
+        }
+    }
+}
+
+// ------------------------------------------------------------
+//  Wire protocol
+// ------------------------------------------------------------
+bool CameraService::request_locked(CapturedFace& out, int timeout_ms) {
+    const char cmd = CAPTURE_CMD_FACE;
+    if (write(to_helper_, &cmd, 1) != 1) {
+        kill_locked();
+        return false;
+    }
+
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    CaptureRecordHeader hdr;
+    if (!read_record(hdr, out, deadline)) {
+        kill_locked();
+        return false;
+    }
+    return hdr.status == CAPTURE_OK;
+}
+
+bool CameraService::read_record(CaptureRecordHeader& hdr, CapturedFace& out,
+                                Clock::time_point deadline,
+                                const RejectSink& on_rejects) {
+    if (!read_full(&hdr, sizeof(hdr), deadline)) return false;
+    if (hdr.magic != CAPTURE_MAGIC || hdr.version != CAPTURE_VERSION ||
+        hdr.record_len != sizeof(hdr) + hdr.payload_len ||
+        hdr.payload_len > MAX_PAYLOAD) {
+        spdlog::error("Camera helper sent a malformed record");
+        return false;
+    }
+    // every record carries the faces dropped since the previous one
+    CaptureRejects dropped;
+    for (int i = 0; i < CAPTURE_REJECT_COUNT; ++i) {
+        dropped.count[i] = hdr.rejects[i];
+        if (hdr.rejects[i])
+            rejects_[i].fetch_add(hdr.rejects[i], std::memory_order_relaxed);
+    }
+    if (on_rejects && dropped.total() > 0) on_rejects(dropped);
+    if (hdr.status != CAPTURE_OK) return true;
+
+    int type = hdr.channels == 3 ? CV_8UC3 : CV_8UC1;
+    if (hdr.payload_len != (uint32_t)hdr.width * hdr.height * hdr.channels) {
+        spdlog::error("Camera helper record size mismatch");
+        return false;
+    }
+
+    out.bgr = cv::Mat(hdr.height, hdr.width, type);
+    if (!read_full(out.bgr.data, hdr.payload_len, deadline)) return false;
+
+    out.score        = hdr.score;
+    out.sharpness    = hdr.sharpness;
+    out.brightness   = hdr.brightness;
+    out.quality      = hdr.quality;
+    out.yaw          = hdr.yaw;
+    out.pitch        = hdr.pitch;
+    out.window       = std::max<int>(1, hdr.window);
+    out.bbox         = cv::Rect2f(hdr.bbox[0], hdr.bbox[1], hdr.bbox[2], hdr.bbox[3]);
+    for (int i = 0; i < 5; ++i)
+        out.landmarks[i] = cv::Point2f(hdr.landmarks[2*i], hdr.landmarks[2*i + 1]);
+    out.timestamp_us = hdr.timestamp_us;
+
+    // the helper's stage times for this face, on the helper's track:
+    // detector and alignment, then best-of-window hold and the pipe
+    if (trace_enabled() && hdr.timestamp_us) {
+        uint64_t grabbed  = hdr.timestamp_us * 1000;
+        uint64_t detected = grabbed  + hdr.detect_time * 10000ull;
+        uint64_t aligned  = detected + hdr.align_time  * 10000ull;
+        trace_span("helper.detect", grabbed,  detected,    pid_, pid_);
+        trace_span("helper.align",  detected, aligned,     pid_, pid_);
+        trace_span("helper.select", aligned,  trace_now(), pid_, pid_);
+    }
+    return true;
+}
+
+bool CameraService::wait_readable(int timeout_ms) {
+    pollfd pfd{from_helper_, POLLIN, 0};
+    int pr;
+    do { pr = poll(&pfd, 1, timeout_ms); } while (pr < 0 && errno == EINTR);
+    return pr > 0;
+}
+
+bool CameraService::read_full(void* buf, size_t n, Clock::time_point deadline) {
+    auto* p = static_cast<char*>(buf);
+    size_t got = 0;
+    while (got < n) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - Clock::now()).count();
+        if (left <= 0) return false;
+
+        pollfd pfd{from_helper_, POLLIN, 0};
+        int pr = poll(&pfd, 1, (int)left);
+        if (pr < 0 && errno == EINTR) continue;
+        if (pr <= 0) return false;
+
+        ssize_t r = read(from_helper_, p + got, n - got);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        got += (size_t)r;
+    }
+    return true;
+}
@@ -0,0 +1,263 @@
+#include "facelock/capture_scheduler.h"
+#include "facelock/trace.h"
+
+#include <chrono>
+#include <spdlog/spdlog.h>
+
+using namespace facelock;
+using Clock = std::chrono::steady_clock;
+
+static int64_t steady_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        Clock::now().time_since_epoch()).count();
+}
+
+// How often waiting requests look at their cancel token
+static constexpr auto CANCEL_POLL = std::chrono::milliseconds(100);
+
+static bool is_cancelled(const CancelToken* cancel) {
+    return cancel && cancel->cancelled();
+}
+
+static int ms_left(Clock::time_point deadline) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - Clock::now()).count();
+    return left > 0 ? (int)left : 0;
+}
+
+CaptureScheduler::CaptureScheduler(CameraService& camera, int coalesce_ms)
+    : camera_(camera), coalesce_ms_(coalesce_ms > 0 ? coalesce_ms : 0) {}
+
+CaptureScheduler::Stats CaptureScheduler::stats() const {
+    return {bursts_.load(std::memory_order_relaxed),
+            shared_.load(std::memory_order_relaxed),
+            frames_.load(std::memory_order_relaxed),
+            preemptions_.load(std::memory_order_relaxed),
+            cancelled_.load(std::memory_order_relaxed),
+            skipped_.load(std::memory_order_relaxed)};
+}
+
+// Nobody notifies cv_ on cancellation, so a cancellable wait sleeps in
+// CANCEL_POLL slices
+template <class Pred>
+bool CaptureScheduler::wait_until(std::unique_lock<std::mutex>& lk,
+                                  Clock::time_point deadline,
+                                  const CancelToken* cancel, Pred ready) {
+    if (!cancel) {
+        if (deadline == Clock::time_point::max()) {
+            cv_.wait(lk, ready);
+            return true;
+        }
+        return cv_.wait_until(lk, deadline, ready);
+    }
+    while (!ready()) {
+        if (cancel->cancelled() || Clock::now() >= deadline) return false;
+        cv_.wait_until(lk, std::min(deadline, Clock::now() + CANCEL_POLL));
+    }
+    return true;
+}
+
+// ------------------------------------------------------------
+//  Shared bursts
+// ------------------------------------------------------------
+int CaptureScheduler::shared_burst(const Embedder& embed, uint64_t model,
+                                   const std::function<bool(const BurstFrame&)>& on_frame,
+                                   int timeout_ms, const CancelToken* cancel,
+                                   CaptureRejects* rejects) {
+    const auto    deadline    = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    const int64_t replay_from = steady_ms() - coalesce_ms_;
+    int  delivered = 0;
+    bool want      = true;
+
+    // A burst can end (its leader ran out of time) while this request
+    // still wants frames; it then joins or leads the next one.
+    while (want && Clock::now() < deadline && !is_cancelled(cancel)) {
+        std::shared_ptr<Burst> b;
+        bool   leader = false;
+        size_t cursor = 0;
+        CaptureRejects rejects0;   // the burst's count when this request attached
+        {
+            std::unique_lock<std::mutex> lk(mtx_);
+            ++auth_waiting_;   // pauses an exclusive stream
+            bool ready;
+            {
+                TraceSpan span("capture.wait");
+                ready = wait_until(lk, deadline, cancel, [&] {
+                    return owner_ == Owner::None ||
+                           (owner_ == Owner::Burst && burst_ && !burst_->closed &&
+                            burst_->model == model);
+                });
+            }
+            --auth_waiting_;
+            if (!ready) {
+                cv_.notify_all();   // an exclusive stream may resume
+                break;
+            }
+
+            if (owner_ == Owner::None) {
+                owner_ = Owner::Burst;
+                burst_ = std::make_shared<Burst>();
+                burst_->model = model;
+                leader = true;
+                bursts_.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                // replay what was captured shortly before this request
+                while (cursor < burst_->frames.size() &&
+                       burst_->frames[cursor].captured_ms < replay_from)
+                    ++cursor;
+                shared_.fetch_add(1, std::memory_order_relaxed);
+            }
+            b = burst_;
+            ++b->active;
+            rejects0 = b->rejects;
+        }
+
+        bool attached = true;
+        auto detach_locked = [&] {
+            if (!attached) return;
+            --b->active;
+            attached = false;
+            if (rejects) rejects->add(b->rejects.since(rejects0));
+        };
+        auto detach = [&] {
+            std::lock_guard<std::mutex> lk(mtx_);
+            detach_locked();
+        };
+
+        if (leader) {
+            // score each frame as soon as the leader has embedded it
+            lead(b, embed, ms_left(deadline), [&] {
+                if (is_cancelled(cancel)) want = false;
+                while (want && attached) {
+                    const BurstFrame* f;
+                    {
+                        std::lock_guard<std::mutex> lk(mtx_);
+                        if (cursor >= b->frames.size()) break;
+                        f = &b->frames[cursor++];
+                    }
+                    ++delivered;
+                    want = on_frame(*f) && !is_cancelled(cancel);
+                }
+                if (!want || Clock::now() >= deadline) detach();
+            });
+            detach();
+        } else {
+            std::unique_lock<std::mutex> lk(mtx_);
+            while (want) {
+                if (!wait_until(lk, deadline, cancel, [&] {
+                        return cursor < b->frames.size() || b->closed; }))
+                    break;
+                if (cursor >= b->frames.size()) break;   // closed
+                const BurstFrame& f = b->frames[cursor++];
+                lk.unlock();
+                ++delivered;
+                want = on_frame(f) && !is_cancelled(cancel);
+                lk.lock();
+            }
+            detach_locked();
+        }
+    }
+    if (is_cancelled(cancel)) {
+        cancelled_.fetch_add(1, std::memory_order_relaxed);
+        cv_.notify_all();   // an exclusive stream may resume
+    }
+    return delivered;
+}
+
+// Run the camera for burst `b` until nobody attached wants frames or
+// timeout_ms elapses; `consume` is the leader's own scoring step. It is
+// also polled while no face is in view, so a cancelled leader detaches.
+void CaptureScheduler::lead(const std::shared_ptr<Burst>& b, const Embedder& embed,
+                            int timeout_ms, const std::function<void()>& consume) {
+    TraceSpan span("capture.burst");
+    auto nobody_left = [&] {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return b->active == 0;
+    };
+
+    camera_.stream([&](CapturedFace& face) {
+        // everyone may have left (cancelled) since the last frame
+        if (nobody_left()) {
+            skipped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        BurstFrame f;
+        f.captured_ms = face.timestamp_us ? (int64_t)(face.timestamp_us / 1000)
+                                          : steady_ms();
+        if (!embed(face.bgr, f.embedding)) f.embedding.clear();
+        frames_.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            b->frames.push_back(std::move(f));
+        }
+        cv_.notify_all();
+        consume();
+        return !nobody_left();
+    }, timeout_ms, [&] {
+        consume();
+        return nobody_left();
+    }, [&](const CaptureRejects& r) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        b->rejects.add(r);
+    });
+
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        b->closed = true;
+        if (burst_ == b) burst_.reset();
+        owner_ = Owner::None;
+    }
+    cv_.notify_all();
+}
+
+// ------------------------------------------------------------
+//  Exclusive streams
+// ------------------------------------------------------------
+int CaptureScheduler::exclusive_stream(const std::function<bool(CapturedFace&)>& on_face,
+                                       int timeout_ms, const CancelToken* cancel,
+                                       const RejectSink& on_rejects) {
+    int  remaining = timeout_ms;
+    int  delivered = 0;
+    bool done      = false;
+
+    std::unique_lock<std::mutex> lk(mtx_);
+    while (!done && remaining > 0) {
+        // time spent waiting for the camera is not limited, only cancelled
+        if (!wait_until(lk, Clock::time_point::max(), cancel, [this] {
+                return owner_ == Owner::None && auth_waiting_ == 0; }))
+            break;
+        owner_ = Owner::Exclusive;
+        lk.unlock();
+
+        bool preempted = false;
+        auto yield = [&] {
+            if (is_cancelled(cancel)) return true;
+            if (auth_waiting_.load() > 0) preempted = true;
+            return preempted;
+        };
+        auto t0 = Clock::now();
+        {
+            TraceSpan span("capture.exclusive");
+            camera_.stream([&](CapturedFace& face) {
+                if (yield()) return false;
+                ++delivered;
+                if (!on_face(face)) done = true;
+                return !done;
+            }, remaining, yield, on_rejects);
+        }
+        remaining -= (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+            Clock::now() - t0).count();
+
+        lk.lock();
+        owner_ = Owner::None;
+        cv_.notify_all();
+        if (is_cancelled(cancel)) {
+            cancelled_.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+        if (!preempted) break;
+        preemptions_.fetch_add(1, std::memory_order_relaxed);
+        spdlog::info("Exclusive capture paused for a waiting auth");
+    }
+    return delivered;
+}
@@ -0,0 +1,86 @@
+#include "facelock/daemon.h"
+#include <spdlog/spdlog.h>
+
+#include <fstream>
+#include <string>
+
+using namespace facelock;
+
+// ---------------------------------------------------------------------------
+// Parse /etc/facelock/facelock.conf  (KEY=VALUE, # comments, blank lines ok)
+// ---------------------------------------------------------------------------
+DaemonConfig facelock::load_config(const std::string &path) {
+    DaemonConfig cfg; // compiled-in defaults
+    cfg.config_path = path;
+
+    std::ifstream f(path);
+    if (!f.is_open()) {
+        spdlog::warn("Config file not found ({}), using defaults", path);
+        return cfg;
+    }
+
+    std::string line;
+    while (std::getline(f, line)) {
+        // strip comments
+        auto pos = line.find('#');
+        if (pos != std::string::npos) line = line.substr(0, pos);
+
+        // strip trailing whitespace / CR
+        while (!line.empty() &&
+               (line.back() == ' ' || line.back() == '\r' || line.back() == '\n'))
+            line.pop_back();
+        if (line.empty()) continue;
+
+        auto eq = line.find('=');
+        if (eq == std::string::npos) continue;
+
+        std::string key   = line.substr(0, eq);
+        std::string value = line.substr(eq + 1);
+
+        // trim both sides
+        auto trim = [](std::string &s) {
+            while (!s.empty() && s.front() == ' ') s.erase(s.begin());
+            while (!s.empty() && s.back()  == ' ') s.pop_back();
+        };
+        trim(key); trim(value);
+
+        if      (key == "SOCKET_PATH")     cfg.socket_path     = value;
+        else if (key == "IPC_BACKLOG")     cfg.ipc_backlog     = std::stoi(value);
+        else if (key == "IPC_WORKERS")     cfg.ipc_workers     = std::stoi(value);
+        else if (key == "IPC_READ_TIMEOUT_MS") cfg.ipc_read_timeout_ms = std::stoi(value);
+        else if (key == "IPC_MAX_REQUEST") cfg.ipc_max_request = std::stoi(value);
+        else if (key == "DATA_DIR")        cfg.data_dir        = value;
+        else if (key == "ONNX_MODEL_PATH") cfg.onnx_model_path = value;
+        else if (key == "ONNX_THRESHOLD")  cfg.onnx_threshold  = std::stof(value);
+        else if (key == "ONNX_POOL_SIZE")     cfg.onnx_pool_size     = std::stoi(value);
+        else if (key == "ONNX_INTRA_THREADS") cfg.onnx_intra_threads = std::stoi(value);
+        else if (key == "ONNX_INTER_THREADS") cfg.onnx_inter_threads = std::stoi(value);
+        else if (key == "ONNX_CACHE_DIR")     cfg.onnx_cache_dir     = value;
+        else if (key == "GALLERY_DTYPE")   cfg.gallery_dtype   = value;
+        else if (key == "CAMERA_DEVICE")   cfg.camera_device   = std::stoi(value);
+        else if (key == "CAMERA_IDLE_TIMEOUT") cfg.camera_idle_timeout = std::stoi(value);
+        else if (key == "CAMERA_BACKEND")  cfg.camera_backend  = value;
+        else if (key == "CAPTURE_WINDOW")  cfg.capture_window  = std::stoi(value);
+        else if (key == "QUALITY_MIN_CONFIDENCE") cfg.quality_min_confidence = std::stof(value);
+        else if (key == "QUALITY_MIN_FACE")       cfg.quality_min_face       = std::stof(value);
+        else if (key == "QUALITY_MAX_YAW")        cfg.quality_max_yaw        = std::stof(value);
+        else if (key == "QUALITY_MAX_PITCH")      cfg.quality_max_pitch      = std::stof(value);
+        else if (key == "QUALITY_MIN_SHARPNESS")  cfg.quality_min_sharpness  = std::stof(value);
+        else if (key == "AUTH_BURST_FRAMES") cfg.auth_burst_frames = std::stoi(value);
+        else if (key == "AUTH_BURST_MS")     cfg.auth_burst_ms     = std::stoi(value);
+        else if (key == "AUTH_BURST_MIN")    cfg.auth_burst_min    = std::stoi(value);
+        else if (key == "AUTH_MARGIN")       cfg.auth_margin       = std::stof(value);
+        else if (key == "AUTH_COALESCE_MS")  cfg.auth_coalesce_ms  = std::stoi(value);
+        else if (key == "ADAPTIVE_GALLERY")  cfg.adaptive_gallery  = value == "1" || value == "true" || value == "yes";
+        else if (key == "ADAPTIVE_MARGIN")   cfg.adaptive_margin   = std::stof(value);
+        else if (key == "ADAPTIVE_MAX")      cfg.adaptive_max      = std::stoi(value);
+        else if (key == "ADAPTIVE_MIN_DIST") cfg.adaptive_min_dist = std::stof(value);
+        else if (key == "IDENTIFY_BRUTE_MAX") cfg.identify_brute_max = std::stoi(value);
+        else if (key == "IDENTIFY_EF_SEARCH") cfg.identify_ef_search = std::stoi(value);
+        else if (key == "TRACE")             cfg.trace             = value == "1" || value == "true" || value == "yes";
+        else if (key == "TRACE_FILE")        cfg.trace_file        = value;
+    }
+
+    spdlog::info("Config loaded from {}", path);
+    return cfg;
+}
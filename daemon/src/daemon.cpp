@@ -1,111 +1,409 @@
 #include "facelock/daemon.h"
 #include "facelock/ipc_server.h"
 #include "facelock/onnx_wrapper.h"
+#include "facelock/camera_service.h"
+#include "facelock/capture_scheduler.h"
+#include "facelock/enroll_job.h"
+#include "facelock/gallery_cache.h"
+#include "facelock/identity_index.h"
+#include "facelock/storage.h"
+#include "facelock/preprocess.h"
+#include "facelock/similarity.h"
+#include "facelock/systemd.h"
+#include "facelock/trace.h"
 
 #include <filesystem>
 #include <thread>
 #include <chrono>
-#include <cstdio>
 #include <cmath>
 #include <algorithm>
 #include <mutex>
+#include <atomic>
+#include <set>
+#include <map>
+#include <deque>
+#include <unordered_map>
+#include <condition_variable>
 #include <syslog.h>
+#include <pwd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
-#include <opencv2/imgproc.hpp>
 #include <spdlog/spdlog.h>
 
 using namespace facelock;
 namespace fs = std::filesystem;
 
 // ============================================================
-//  ONNX session cache — one instance per model path, shared
+//  ONNX session cache — a pool of sessions over one model, shared
 //  across all requests so we never pay session startup cost
-//  during auth (was the biggest latency hit in v2.0).
+//  during auth (was the biggest latency hit in v2.0) and
+//  concurrent requests do not queue behind a single session.
 // ============================================================
-struct Daemon::Impl {
-    std::unique_ptr<ONNXWrapper> onnx;
-    std::mutex                   onnx_mtx;
+static long long ms_between(std::chrono::steady_clock::time_point a,
+                            std::chrono::steady_clock::time_point b) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(b - a).count();
+}
 
-    bool load(const std::string& model_path) {
-        std::lock_guard<std::mutex> lk(onnx_mtx);
-        if (onnx) return true;           // already loaded
-        try {
-            onnx = std::make_unique<ONNXWrapper>(model_path);
-            // warmup: two dummy inferences so the first real auth isn't slow
-            cv::Mat dummy(112, 112, CV_8UC3, cv::Scalar(128, 128, 128));
-            onnx->warmup(dummy, 2);
-            spdlog::info("ONNX session ready (model cached)");
-            return true;
-        } catch (const std::exception& e) {
-            spdlog::error("ONNX session load failed: {}", e.what());
-            return false;
-        }
+// load the model and warm every session; nullptr if it cannot be loaded
+static std::shared_ptr<ONNXSessionPool> load_model(const DaemonConfig& cfg) {
+    TraceSpan span("model.load");
+    if (!fs::exists(cfg.onnx_model_path)) {
+        spdlog::error("ONNX model not found: {}", cfg.onnx_model_path);
+        spdlog::error("Run the installer or download the model to {}",
+                      cfg.onnx_model_path);
+        return nullptr;
+    }
+
+    ONNXOptions opts;
+    opts.intra_op_threads = cfg.onnx_intra_threads;
+    opts.inter_op_threads = cfg.onnx_inter_threads;
+    opts.cache_dir        = cfg.onnx_cache_dir;
+    try {
+        auto t0 = std::chrono::steady_clock::now();
+        auto onnx = std::make_shared<ONNXSessionPool>(
+            cfg.onnx_model_path, (size_t)cfg.onnx_pool_size, opts);
+        auto t1 = std::chrono::steady_clock::now();
+        // warmup: two dummy inferences per session so the first real
+        // auth isn't slow
+        cv::Mat dummy(112, 112, CV_8UC3, cv::Scalar(128, 128, 128));
+        onnx->warmup(dummy, 2);
+        auto t2 = std::chrono::steady_clock::now();
+        spdlog::info("ONNX session pool ready ({} sessions, {} intra / {} inter threads): "
+                     "load {} ms, warmup {} ms",
+                     onnx->size(), opts.intra_op_threads, opts.inter_op_threads,
+                     ms_between(t0, t1), ms_between(t1, t2));
+        return onnx;
+    } catch (const std::exception& e) {
+        spdlog::error("ONNX session load failed: {}", e.what());
+        return nullptr;
+    }
+}
+
+// ============================================================
+//  Enrolled templates — the gallery cache plus the 1:N index built
+//  from it. Both are tied to one data dir and model; a reload that
+//  keeps those shares them with the new engine.
+// ============================================================
+struct Templates {
+    // enrolled templates, loaded once per user
+    std::unique_ptr<GalleryCache> galleries;
+
+    // 1:N index over every gallery, built on the first identify and then
+    // kept current from the gallery cache's invalidations
+    std::unique_ptr<IdentityIndex> identities;
+    std::mutex                     id_mtx;        // guards the dirty state
+    std::set<std::string>          id_dirty;
+    bool                           id_rescan = true;
+    std::mutex                     id_refresh;    // one refresh at a time
+    std::set<std::string>          id_users;      // users in the index
+
+    Templates(const DaemonConfig& cfg, uint64_t model_hash) {
+        galleries = std::make_unique<GalleryCache>(cfg.data_dir, model_hash,
+                                                   cfg.adaptive_gallery);
+        IdentityIndex::Params ip;
+        ip.brute_max = (size_t)std::max(0, cfg.identify_brute_max);
+        ip.ef_search = cfg.identify_ef_search;
+        identities = std::make_unique<IdentityIndex>(ip);
+        galleries->set_listener([this](const std::string& user) {
+            mark_dirty(user);
+        });
     }
 
-    std::vector<float> embed(const cv::Mat& face) {
-        std::lock_guard<std::mutex> lk(onnx_mtx);
-        if (!onnx) return {};
-        return onnx->embed(face);
+    void mark_dirty(const std::string& user) {
+        std::lock_guard<std::mutex> lk(id_mtx);
+        if (user.empty()) id_rescan = true;
+        else              id_dirty.insert(user);
+    }
+
+    // apply pending gallery changes to the index; a rescan (first use,
+    // inotify overflow, reload) re-reads the whole data directory
+    void refresh_identities(const std::string& data_dir) {
+        std::lock_guard<std::mutex> refresh(id_refresh);
+        std::set<std::string> todo;
+        bool rescan;
+        {
+            std::lock_guard<std::mutex> lk(id_mtx);
+            todo.swap(id_dirty);
+            rescan    = id_rescan;
+            id_rescan = false;
+        }
+        if (rescan) {
+            for (auto& u : list_galleries(data_dir)) todo.insert(u);
+            todo.insert(id_users.begin(), id_users.end());
+        }
+        if (todo.empty()) return;
+
+        for (const auto& user : todo) {
+            GalleryPtr g = galleries->get(user);
+            if (g) {
+                identities->set_user(user, *g);
+                id_users.insert(user);
+            } else {
+                identities->remove_user(user);
+                id_users.erase(user);
+            }
+        }
+        spdlog::debug("Identify index refreshed: {} users, {} templates{}",
+                      identities->users(), identities->templates(),
+                      identities->graph() ? " (hnsw)" : "");
     }
 };
 
 // ============================================================
-//  Enrollment quality check — rejects blurry or too-small faces
+//  Engine — the config, model and templates a request works
+//  against. Reload builds a new one and swaps it in atomically; a
+//  request keeps the engine it started with until it finishes.
 // ============================================================
-static bool quality_ok(const cv::Mat& bgr) {
-    if (bgr.empty()) return false;
+struct Engine {
+    DaemonConfig                     cfg;
+    std::shared_ptr<ONNXSessionPool> onnx;
+    std::shared_ptr<Templates>       templates;
+    GalleryDType                     gallery_dtype = GALLERY_F32;
+    uint64_t                         generation    = 0;   // reloads applied
 
-    // Laplacian variance — low = blurry
-    cv::Mat gray, lap;
-    cv::cvtColor(bgr, gray, cv::COLOR_BGR2GRAY);
-    cv::Laplacian(gray, lap, CV_64F);
-    cv::Scalar mean, stddev;
-    cv::meanStdDev(lap, mean, stddev);
-    double sharpness = stddev.val[0] * stddev.val[0];
+    GalleryCache&  galleries()  { return *templates->galleries; }
+    IdentityIndex& identities() { return *templates->identities; }
+    uint64_t       model_hash() const { return onnx->model_hash(); }
 
-    if (sharpness < 30.0) {
-        spdlog::debug("Quality reject: blurry (laplacian var={:.1f})", sharpness);
-        return false;
+    // embed into a caller-owned buffer; reusing `out` across calls keeps
+    // the steady-state auth path free of allocations
+    bool embed_into(const cv::Mat& face, std::vector<float>& out) {
+        TraceSpan span("embed");
+        auto session = onnx->acquire();
+        size_t dim = session->embedding_dim();
+        if (dim == 0) {
+            out = session->embed(face);
+            return !out.empty();
+        }
+        out.resize(dim);
+        return session->embed_into(face, out.data(), out.size());
     }
 
-    // Rough brightness check: reject near-black or near-white frames
-    cv::Scalar img_mean = cv::mean(gray);
-    if (img_mean.val[0] < 20.0 || img_mean.val[0] > 240.0) {
-        spdlog::debug("Quality reject: bad brightness (mean={:.1f})", img_mean.val[0]);
-        return false;
+    cv::Mat embed_batch(const std::vector<cv::Mat>& faces) {
+        if (faces.empty()) return {};
+        TraceSpan span("embed.batch");
+        try {
+            auto session = onnx->acquire();
+            return session->embed_batch(faces);
+        } catch (const std::exception& e) {
+            spdlog::error("Batched embed failed: {}", e.what());
+            return {};
+        }
     }
+};
+
+using EnginePtr = std::shared_ptr<Engine>;
+
+static EnginePtr make_engine(const DaemonConfig& cfg,
+                             std::shared_ptr<ONNXSessionPool> onnx,
+                             std::shared_ptr<Templates> templates) {
+    auto e = std::make_shared<Engine>();
+    e->cfg       = cfg;
+    e->onnx      = std::move(onnx);
+    e->templates = templates ? std::move(templates)
+                             : std::make_shared<Templates>(cfg, e->model_hash());
+    if (!parse_gallery_dtype(cfg.gallery_dtype, e->gallery_dtype))
+        spdlog::warn("Unknown GALLERY_DTYPE '{}', storing f32", cfg.gallery_dtype);
+    return e;
+}
+
+struct Daemon::Impl {
+    // current engine; read with engine(), replaced only by reload
+    EnginePtr  current;
+    std::mutex reload_mtx;   // one reload at a time
+
+    EnginePtr engine() const { return std::atomic_load(&current); }
+
+    // persistent camera helper — device and detector stay open
+    std::unique_ptr<CameraService> camera;
+
+    // who gets the camera: shared auth bursts, exclusive enrollment
+    std::unique_ptr<CaptureScheduler> capture;
+
+    // serialises adaptive log updates (learn, rollback, re-enroll)
+    std::mutex adapt_mtx;
+
+    // confident auth embeddings waiting to be learned, on one thread
+    // started with the first of them
+    struct LearnItem {
+        EnginePtr          eng;
+        std::string        user;
+        std::vector<float> emb;
+        float              score;
+    };
+    std::mutex              learn_mtx;
+    std::condition_variable learn_cv;
+    std::deque<LearnItem>   learn_queue;
+    bool                    learn_stop = false;
+    std::thread             learner;
+
+    // requests whose client left before the reply, and the time spent on them
+    std::atomic<uint64_t> cancelled{0};
+    std::atomic<uint64_t> wasted_ms{0};
+
+    // enrollment jobs, running and recently finished. Declared last so
+    // they are cancelled and joined before the camera goes away.
+    std::mutex                                        jobs_mtx;
+    std::map<std::string, std::shared_ptr<EnrollJob>> jobs;
+    uint64_t                                          next_job = 0;
+
+    ~Impl();
+
+    void learn(const EnginePtr& eng, const std::string& user,
+               const std::vector<float>& emb, float score);
+    void learn_async(LearnItem item);
+    void learn_loop();
+
+    json finish_enroll(const EnginePtr& eng, const std::string& user,
+                       const std::vector<float>& emb, size_t dim,
+                       const EnrollJob::Counts& counts, bool cancelled);
+
+    std::shared_ptr<EnrollJob> find_job(const std::string& id);
+};
+
+// Finished enrollment jobs stay queryable for this long
+static constexpr auto ENROLL_JOB_KEEP = std::chrono::minutes(10);
+
+// Faces looked at, and camera time, before an enrollment gives up
+static constexpr int ENROLL_MAX_ATTEMPTS = 60;
+static constexpr int ENROLL_TIMEOUT_MS   = 45000;
+
+// ============================================================
+//  Scoring — top-3 cosine distance average for stability.
+//  Query and templates are both L2-normalised, so the SIMD dot
+//  product is the cosine similarity.
+// ============================================================
+static float top3_distance(const std::vector<float>& query,
+                           const Gallery& stored) {
+    TraceSpan span("score");
+    if (query.size() != stored.dim()) return 1.f;   // other model's templates
+    float best[3];
+    size_t top = top_k_distances(query.data(), stored.matrix(), 3, best);
+    float score = 0.f;
+    for (size_t i = 0; i < top; ++i) score += best[i];
+    return top > 0 ? score / top : 1.f;
+}
+
+// ============================================================
+//  Adaptive gallery policy
+//  A confident auth embedding is learned only if it is not already
+//  covered (at least min_dist from every template). When the learned
+//  set is full, the learned template whose nearest neighbour is
+//  closest, i.e. the most redundant one, makes room; the candidate is
+//  dropped instead if it would be that template. Enrolled templates
+//  are never retired.
+// ============================================================
+static bool adaptive_admit(const float* cand, const Gallery& base,
+                           const AdaptiveLog& log, size_t max_learned,
+                           float min_dist, uint32_t& drop_seq) {
+    drop_seq = 0;
+    if (max_learned == 0 || log.dim != base.dim()) return false;
+    const size_t dim = base.dim();
+    const size_t n   = log.live.size();
+
+    // distance from x to the nearest template other than learned #self
+    auto nearest = [&](const float* x, size_t self) {
+        float d = 1.f;
+        top_k_distances(x, base.matrix(), 1, &d);
+        for (size_t i = 0; i < n; ++i)
+            if (i != self) d = std::min(d, 1.f - dot(x, log.live[i].row.data(), dim));
+        return d;
+    };
 
+    float dc = nearest(cand, n);
+    if (dc < min_dist) return false;
+    if (n < max_learned) return true;
+
+    size_t worst = n;
+    float  wd    = dc;
+    for (size_t i = 0; i < n; ++i) {
+        const float* a = log.live[i].row.data();
+        float d = std::min(nearest(a, i), 1.f - dot(a, cand, dim));
+        if (d < wd) { wd = d; worst = i; }
+    }
+    if (worst == n) return false;
+    drop_seq = log.live[worst].seq;
     return true;
 }
 
 // ============================================================
-//  Camera capture
+//  Burst score fusion
+//  Fused score = mean of the best majority (n/2 + 1) of per-frame
+//  scores, so one blurred or half-turned frame cannot sink an otherwise
+//  clear match while a single lucky frame is not enough on its own.
+//  A match needs `min_frames` frames inside the threshold; only a first
+//  frame well inside it (threshold - margin) decides alone.
 // ============================================================
-static bool capture_face_bgr(cv::Mat& out, int camera_device = 0) {
-    char cmd[256];
-    snprintf(cmd, sizeof(cmd),
-             "/usr/lib/facelock/facelock-camera-helper --mode bgr112 --camera %d",
-             camera_device);
-    FILE* fp = popen(cmd, "r");
-    if (!fp) return false;
-
-    out = cv::Mat(112, 112, CV_8UC3);
-    size_t need = 112 * 112 * 3;
-    size_t got  = 0;
-    auto start = std::chrono::steady_clock::now();
-
-    while (got < need) {
-        if (std::chrono::steady_clock::now() - start > std::chrono::seconds(5)) {
-            pclose(fp);
-            return false;
-        }
-        size_t r = fread(out.data + got, 1, need - got, fp);
-        if (r == 0) break;
-        got += r;
+class ScoreFusion {
+public:
+    ScoreFusion(float threshold, float margin, int min_frames)
+        : threshold_(threshold), margin_(margin),
+          min_frames_(std::max(1, min_frames)) {}
+
+    void add(float s) {
+        scores_.push_back(s);
+        if (s <= threshold_) ++agree_;
+    }
+    int  frames() const { return (int)scores_.size(); }
+
+    float score() const {
+        if (scores_.empty()) return 1.f;
+        std::vector<float> v = scores_;
+        size_t k = v.size() / 2 + 1;
+        std::partial_sort(v.begin(), v.begin() + k, v.end());
+        float sum = 0.f;
+        for (size_t i = 0; i < k; ++i) sum += v[i];
+        return sum / k;
     }
-    pclose(fp);
-    return got == need;
+
+    // the evidence so far is a match
+    bool accepted() const {
+        if (scores_.empty()) return false;
+        float s = score();
+        if (frames() == 1 && s <= threshold_ - margin_) return true;  // confident first frame
+        return agree_ >= min_frames_ && s <= threshold_;
+    }
+
+    // true once the evidence is conclusive either way
+    bool decided() const {
+        if (accepted()) return true;
+        return frames() >= min_frames_ && score() >= threshold_ + margin_;
+    }
+
+private:
+    float              threshold_;
+    float              margin_;
+    int                min_frames_;
+    int                agree_ = 0;   // frames inside the threshold
+    std::vector<float> scores_;
+};
+
+// Longest overall budget an auth request may ask for ("deadline_ms")
+static constexpr int AUTH_MAX_DEADLINE_MS = 30000;
+
+// Don't start another burst with less than this left of the budget
+static constexpr int AUTH_MIN_RETRY_MS = 500;
+
+// ============================================================
+//  Capture rejects — faces the helper dropped before they were
+//  embedded, turned into advice for the person at the camera
+// ============================================================
+static std::string reject_hint(const CaptureRejects& r) {
+    static const char* const HINTS[CAPTURE_REJECT_COUNT] = {
+        "Look at the camera",            // confidence
+        "Move closer to the camera",     // size
+        "Look straight at the camera",   // pose
+        "Hold still",                    // blur
+        "More light needed",             // dark
+        "Too bright, avoid light shining into the camera",   // bright
+    };
+    int worst = 0;
+    for (int i = 1; i < CAPTURE_REJECT_COUNT; ++i)
+        if (r.count[i] > r.count[worst]) worst = i;
+    return HINTS[worst];
 }
 
 // ============================================================
@@ -138,6 +436,163 @@ static void audit(const std::string& event,
     closelog();
 }
 
+// ============================================================
+//  Callers — the socket is open to every local user; requests that
+//  change daemon-wide or another user's state check who asks
+// ============================================================
+static bool is_root(const PeerCred& peer) { return peer.uid == 0; }
+
+// root, or the account `user` names
+static bool may_act_for(const PeerCred& peer, const std::string& user) {
+    if (is_root(peer)) return true;
+    if (peer.uid == (uid_t)-1) return false;
+    passwd  pw;
+    passwd* found = nullptr;
+    char    buf[4096];
+    return getpwnam_r(user.c_str(), &pw, buf, sizeof(buf), &found) == 0 &&
+           found && found->pw_uid == peer.uid;
+}
+
+// ============================================================
+//  Adaptive learning
+// ============================================================
+
+// Embeddings queued for the learner; under auth load the oldest are
+// dropped rather than holding up auth or piling up threads
+static constexpr size_t LEARN_QUEUE_MAX = 8;
+
+Daemon::Impl::~Impl() {
+    {
+        std::lock_guard<std::mutex> lk(learn_mtx);
+        learn_stop = true;
+    }
+    learn_cv.notify_all();
+    if (learner.joinable()) learner.join();
+}
+
+void Daemon::Impl::learn_async(LearnItem item) {
+    {
+        std::lock_guard<std::mutex> lk(learn_mtx);
+        if (learn_stop) return;
+        if (learn_queue.size() >= LEARN_QUEUE_MAX) {
+            spdlog::debug("Adaptive: learner busy, dropping the sample of '{}'",
+                          learn_queue.front().user);
+            learn_queue.pop_front();
+        }
+        learn_queue.push_back(std::move(item));
+        if (!learner.joinable())
+            learner = std::thread(&Impl::learn_loop, this);
+    }
+    learn_cv.notify_one();
+}
+
+void Daemon::Impl::learn_loop() {
+    std::unique_lock<std::mutex> lk(learn_mtx);
+    while (true) {
+        learn_cv.wait(lk, [&] { return learn_stop || !learn_queue.empty(); });
+        if (learn_stop) return;   // pending samples are only an optimisation
+        LearnItem item = std::move(learn_queue.front());
+        learn_queue.pop_front();
+        lk.unlock();
+        learn(item.eng, item.user, item.emb, item.score);
+        lk.lock();
+    }
+}
+
+void Daemon::Impl::learn(const EnginePtr& eng, const std::string& user,
+                         const std::vector<float>& emb, float score) {
+    std::lock_guard<std::mutex> lk(adapt_mtx);
+    const DaemonConfig& cfg = eng->cfg;
+    std::string err;
+    uint64_t hash = eng->model_hash();
+    GalleryPtr base = load_gallery(cfg.data_dir, user, hash, err);
+    if (!base || base->dim() != emb.size()) return;
+
+    AdaptiveLog log;
+    if (!read_adaptive(cfg.data_dir, user, hash, log)) {
+        log = AdaptiveLog{};
+        log.dim        = base->dim();
+        log.model_hash = hash;
+    }
+
+    uint32_t drop = 0;
+    if (!adaptive_admit(emb.data(), *base, log, (size_t)std::max(0, cfg.adaptive_max),
+                        cfg.adaptive_min_dist, drop)) {
+        spdlog::debug("Adaptive: '{}' embedding already covered, not learned", user);
+        return;
+    }
+    uint32_t seq = log.next_seq;
+    if (!append_adaptive(cfg.data_dir, user, log, emb.data(), score, drop)) {
+        audit("adapt", user, false, score, cfg.onnx_threshold, "write_failed");
+        return;
+    }
+    eng->galleries().invalidate(user);
+    audit("adapt", user, true, score, cfg.onnx_threshold,
+          drop ? fmt::format("learned={} retired={} total={}", seq, drop, log.live.size())
+               : fmt::format("learned={} total={}", seq, log.live.size()));
+}
+
+// ============================================================
+//  Enrollment — the last step of an enroll job, once every stage
+//  has drained: store the gallery and reset what was learned
+// ============================================================
+json Daemon::Impl::finish_enroll(const EnginePtr& eng, const std::string& user,
+                                 const std::vector<float>& emb, size_t dim,
+                                 const EnrollJob::Counts& counts, bool cancelled) {
+    const DaemonConfig& cfg = eng->cfg;
+    if (cancelled) {
+        // the samples written so far stay; the gallery is left untouched
+        audit("enroll", user, false, -1.f, -1.f,
+              fmt::format("cancelled after {} samples", counts.accepted));
+        return {{"v",2},{"ok",false},{"err","cancelled"}};
+    }
+
+    int got = counts.embedded;
+    if (got < cfg.enroll_min) {
+        audit("enroll", user, false, -1.f, -1.f,
+              fmt::format("only {} samples captured", got));
+        return {{"v",2},{"ok",false},{"err","not_enough_faces"},{"got",got},
+                {"need",cfg.enroll_min},{"rejects",counts.rejects},
+                {"hint",counts.rejects.total() > 0
+                            ? reject_hint(counts.rejects)
+                            : "Make sure the camera can see your face clearly, "
+                              "lighting is adequate, and hold still during enrollment."}};
+    }
+
+    // atomically replace the gallery file
+    uint32_t N = (uint32_t)got;
+    if (!save_gallery(cfg.data_dir, user, emb.data(), N, (uint32_t)dim,
+                      eng->model_hash(), eng->gallery_dtype)) {
+        audit("enroll", user, false, -1.f, -1.f, "write_failed");
+        return {{"v",2},{"ok",false},{"err","write_failed"},
+                {"hint","Check permissions on " + cfg.data_dir}};
+    }
+    // a new enrollment is a new baseline: forget what was learned
+    bool reset;
+    {
+        std::lock_guard<std::mutex> lk(adapt_mtx);
+        reset = remove_adaptive(cfg.data_dir, user);
+    }
+    if (reset) audit("adapt_rollback", user, true, -1.f, -1.f, "re-enrolled");
+
+    // don't wait for inotify: the next auth must see the new templates
+    eng->galleries().invalidate(user);
+
+    audit("enroll", user, true, -1.f, -1.f,
+          fmt::format("samples={} quality_rejects={}", N, counts.rejects.total()));
+    spdlog::info("Enrolled {} embeddings for user '{}' ({} quality rejects)",
+                 N, user, counts.rejects.total());
+
+    return {{"v",2},{"ok",true},{"samples",(int)N},
+            {"quality_rejects",counts.rejects.total()},{"rejects",counts.rejects}};
+}
+
+std::shared_ptr<EnrollJob> Daemon::Impl::find_job(const std::string& id) {
+    std::lock_guard<std::mutex> lk(jobs_mtx);
+    auto it = jobs.find(id);
+    return it == jobs.end() ? nullptr : it->second;
+}
+
 // ============================================================
 //  Daemon
 // ============================================================
@@ -147,193 +602,625 @@ Daemon::Daemon(const DaemonConfig& cfg)
 Daemon::~Daemon() = default;
 
 bool Daemon::initialize() {
+    trace_enable(cfg_.trace);   // before the model, so its load is traced too
     fs::create_directories(cfg_.data_dir);
 
-    if (!fs::exists(cfg_.onnx_model_path)) {
-        spdlog::error("ONNX model not found: {}", cfg_.onnx_model_path);
-        spdlog::error("Run the installer or download the model to {}",
-                      cfg_.onnx_model_path);
-        return false;
-    }
+    auto onnx = load_model(cfg_);
+    if (!onnx) return false;
+    std::atomic_store(&pimpl_->current, make_engine(cfg_, std::move(onnx), nullptr));
+    EnginePtr eng = pimpl_->engine();
 
-    if (!pimpl_->load(cfg_.onnx_model_path))
-        return false;
+    CaptureQuality quality;
+    quality.min_confidence = cfg_.quality_min_confidence;
+    quality.min_face       = cfg_.quality_min_face;
+    quality.max_yaw        = cfg_.quality_max_yaw;
+    quality.max_pitch      = cfg_.quality_max_pitch;
+    quality.min_sharpness  = cfg_.quality_min_sharpness;
+    quality.window         = std::max(1, cfg_.capture_window);
+    pimpl_->camera = std::make_unique<CameraService>(
+        cfg_.camera_helper, cfg_.camera_device, cfg_.camera_idle_timeout,
+        cfg_.camera_backend, quality);
+    pimpl_->capture = std::make_unique<CaptureScheduler>(
+        *pimpl_->camera, cfg_.auth_coalesce_ms);
 
     spdlog::info("AstraLock v2.1 daemon starting");
     spdlog::info("Model:     {}", cfg_.onnx_model_path);
     spdlog::info("Threshold: {:.4f}", cfg_.onnx_threshold);
     spdlog::info("Camera:    /dev/video{}", cfg_.camera_device);
+    spdlog::info("Preproc:   {}", preprocess_kernel_name());
+    spdlog::info("Scoring:   {} ({} templates)", similarity_kernel_name(),
+                 gallery_dtype_name(eng->gallery_dtype));
+    if (cfg_.trace)
+        spdlog::info("Tracing:   on, SIGUSR1 writes {}", cfg_.trace_file);
+    if (cfg_.adaptive_gallery)
+        spdlog::info("Adaptive:  up to {} learned templates per user, "
+                     "auth score <= {:.4f}", cfg_.adaptive_max,
+                     cfg_.onnx_threshold - cfg_.adaptive_margin);
     return true;
 }
 
-json Daemon::handle_request(const json& req) {
+// ============================================================
+//  Reload — re-read the config and swap in a new engine. A new
+//  model is built and warmed while requests keep running on the
+//  current one; templates are kept when data dir, model and index
+//  settings are unchanged, and re-read either way.
+// ============================================================
+json Daemon::reload(const char* trigger) {
+    std::lock_guard<std::mutex> lk(pimpl_->reload_mtx);
+    EnginePtr cur = pimpl_->engine();
+    const DaemonConfig& old = cur->cfg;
+
+    spdlog::info("Reload ({}): reading {}", trigger, cfg_.config_path);
+    DaemonConfig next;
+    try {
+        next = load_config(cfg_.config_path);
+    } catch (const std::exception& e) {
+        spdlog::error("Reload: bad config, keeping the current one: {}", e.what());
+        return {{"v",2},{"ok",false},{"err","bad_config"},{"hint",e.what()}};
+    }
+    sd_notify_state("RELOADING=1\nSTATUS=Reloading");
+
+    // bound at startup (socket, workers, camera): restart to change
+    json restart = json::array();
+    auto keep = [&](auto& field, const auto& cur_value, const char* key) {
+        if (field != cur_value) restart.push_back(key);
+        field = cur_value;
+    };
+    keep(next.socket_path,         old.socket_path,         "SOCKET_PATH");
+    keep(next.ipc_backlog,         old.ipc_backlog,         "IPC_BACKLOG");
+    keep(next.ipc_workers,         old.ipc_workers,         "IPC_WORKERS");
+    keep(next.ipc_read_timeout_ms, old.ipc_read_timeout_ms, "IPC_READ_TIMEOUT_MS");
+    keep(next.ipc_max_request,     old.ipc_max_request,     "IPC_MAX_REQUEST");
+    keep(next.camera_device,       old.camera_device,       "CAMERA_DEVICE");
+    keep(next.camera_helper,       old.camera_helper,       "CAMERA_HELPER");
+    keep(next.camera_backend,      old.camera_backend,      "CAMERA_BACKEND");
+    keep(next.camera_idle_timeout, old.camera_idle_timeout, "CAMERA_IDLE_TIMEOUT");
+    keep(next.auth_coalesce_ms,    old.auth_coalesce_ms,    "AUTH_COALESCE_MS");
+    keep(next.capture_window,      old.capture_window,      "CAPTURE_WINDOW");
+    keep(next.quality_min_confidence, old.quality_min_confidence, "QUALITY_MIN_CONFIDENCE");
+    keep(next.quality_min_face,       old.quality_min_face,       "QUALITY_MIN_FACE");
+    keep(next.quality_max_yaw,        old.quality_max_yaw,        "QUALITY_MAX_YAW");
+    keep(next.quality_max_pitch,      old.quality_max_pitch,      "QUALITY_MAX_PITCH");
+    keep(next.quality_min_sharpness,  old.quality_min_sharpness,  "QUALITY_MIN_SHARPNESS");
+    for (const auto& key : restart)
+        spdlog::warn("Reload: {} changed, takes effect after a restart",
+                     key.get<std::string>());
+
+    bool model_changed = next.onnx_model_path    != old.onnx_model_path ||
+                         next.onnx_pool_size     != old.onnx_pool_size ||
+                         next.onnx_intra_threads != old.onnx_intra_threads ||
+                         next.onnx_inter_threads != old.onnx_inter_threads ||
+                         next.onnx_cache_dir     != old.onnx_cache_dir;
+    auto onnx = cur->onnx;
+    if (model_changed) {
+        fs::create_directories(next.data_dir);
+        onnx = load_model(next);
+        if (!onnx) {
+            sd_notify_state("READY=1\nSTATUS=Reload failed, model unchanged");
+            return {{"v",2},{"ok",false},{"err","model_load_failed"},
+                    {"hint","Check ONNX_MODEL_PATH; the current model stays in use"}};
+        }
+    }
+
+    std::shared_ptr<Templates> templates;
+    if (onnx->model_hash() == cur->model_hash() &&
+        next.data_dir           == old.data_dir &&
+        next.adaptive_gallery   == old.adaptive_gallery &&
+        next.identify_brute_max == old.identify_brute_max &&
+        next.identify_ef_search == old.identify_ef_search) {
+        templates = cur->templates;
+        templates->galleries->clear();   // re-read lazily, index rescans
+    }
+
+    if (next.trace != old.trace) {
+        trace_enable(next.trace);
+        spdlog::info("Reload: tracing {}", next.trace ? "enabled" : "disabled");
+    }
+
+    EnginePtr eng  = make_engine(next, std::move(onnx), templates);
+    eng->generation = cur->generation + 1;
+    std::atomic_store(&pimpl_->current, eng);
+
+    spdlog::info("Reload {} applied: model {}{}, threshold {:.4f}, templates {}",
+                 eng->generation, next.onnx_model_path,
+                 model_changed ? " (reloaded)" : "", next.onnx_threshold,
+                 templates ? "kept" : "rebuilt");
+    sd_notify_state("READY=1\nSTATUS=Reloaded");
+    return {{"v",2},{"ok",true},{"generation",eng->generation},
+            {"model_reloaded",model_changed},{"templates_kept",(bool)templates},
+            {"restart_required",restart}};
+}
+
+json Daemon::handle_request(const json& req, const Emit& emit,
+                            const CancelToken& cancel, const PeerCred& peer) {
     const std::string cmd  = req.value("cmd",  "");
     const std::string user = req.value("user", "");
 
-    if (user.empty())
+    // the whole request runs on this engine, even if a reload swaps it
+    EnginePtr eng = pimpl_->engine();
+    const DaemonConfig& cfg = eng->cfg;
+    auto embed = [&eng](const cv::Mat& face, std::vector<float>& out) {
+        return eng->embed_into(face, out);
+    };
+
+    if (cmd == "reload") {
+        if (!is_root(peer)) {
+            spdlog::warn("Reload refused for uid {} (pid {})", (long)peer.uid, (long)peer.pid);
+            return {{"v",2},{"ok",false},{"err","permission_denied"},
+                    {"hint","Only root may reload: sudo systemctl reload facelock"}};
+        }
+        return reload("request");
+    }
+
+    // ---- TRACE ----
+    // "enable" switches span recording; without it the spans recorded so
+    // far come back as Chrome trace JSON. Spans time other users' auths,
+    // so both are root only.
+    if (cmd == "trace") {
+        if (!is_root(peer)) {
+            spdlog::warn("Trace refused for uid {} (pid {})", (long)peer.uid, (long)peer.pid);
+            return {{"v",2},{"ok",false},{"err","permission_denied"},
+                    {"hint","Only root may trace: sudo facelock trace"}};
+        }
+        if (req.contains("enable")) {
+            bool on = req.value("enable", false);
+            trace_enable(on);
+            spdlog::info("Tracing {} (request)", on ? "enabled" : "disabled");
+            return {{"v",2},{"ok",true},{"enabled",on}};
+        }
+        return {{"v",2},{"ok",true},{"enabled",trace_enabled()},{"trace",trace_dump()}};
+    }
+
+    // ---- ENROLL JOBS ----
+    if (cmd == "enroll_status" || cmd == "enroll_wait" || cmd == "enroll_cancel") {
+        auto job = pimpl_->find_job(req.value("job", ""));
+        if (!job)
+            return {{"v",2},{"ok",false},{"err","unknown_job"},
+                    {"hint","Jobs are kept for 10 minutes after they finish"}};
+        if (!may_act_for(peer, job->user())) {
+            audit(cmd, job->user(), false, -1.f, -1.f,
+                  fmt::format("denied uid={} job={}", (long)peer.uid, job->id()));
+            return {{"v",2},{"ok",false},{"err","permission_denied"},
+                    {"hint","Only root or " + job->user() + " may use this job"}};
+        }
+        if (cmd == "enroll_cancel") job->cancel();
+        if (cmd == "enroll_wait") {
+            // a waiter leaving does not stop the job
+            json result = job->wait(emit, &cancel);
+            if (!result.is_null()) return result;
+            return {{"v",2},{"ok",false},{"err","cancelled"}};
+        }
+        return job->status();
+    }
+
+    if (user.empty() && cmd != "identify")
         return {{"v",2},{"ok",false},{"err","no_user"},
                 {"hint","Provide a 'user' field in the request"}};
 
     // ---- ENROLL ----
+    // Runs as a background job. "async": true returns its id at once;
+    // otherwise the reply waits for the result (with progress events for
+    // v3 clients) and the job is cancelled if the client goes away.
     if (cmd == "enroll") {
-        fs::path userdir = fs::path(cfg_.data_dir) / user;
+        if (!may_act_for(peer, user)) {
+            audit("enroll", user, false, -1.f, -1.f,
+                  fmt::format("denied uid={}", (long)peer.uid));
+            return {{"v",2},{"ok",false},{"err","permission_denied"},
+                    {"hint","Only root or " + user + " may enroll " + user}};
+        }
+        fs::path userdir = fs::path(cfg.data_dir) / user;
         fs::create_directories(userdir);
 
-        std::vector<std::vector<float>> embeddings;
-        int attempts     = 0;
-        int quality_fails = 0;
-        auto start = std::chrono::steady_clock::now();
+        EnrollJob::Params params;
+        params.target       = cfg.enroll_target;
+        params.max_attempts = ENROLL_MAX_ATTEMPTS;
+        params.timeout_ms   = ENROLL_TIMEOUT_MS;
+        params.sample_dir   = userdir.string();
 
-        spdlog::info("Enroll started for user '{}'", user);
+        EnrollJob::Stages stages;
+        stages.capture = [this](const std::function<bool(CapturedFace&)>& on_face,
+                                int timeout_ms, const CancelToken* c,
+                                const RejectSink& on_rejects) {
+            // exclusive, but an auth arriving meanwhile pauses it
+            return pimpl_->capture->exclusive_stream(on_face, timeout_ms, c, on_rejects);
+        };
+        stages.embed   = [eng](const std::vector<cv::Mat>& faces) {
+            return eng->embed_batch(faces);
+        };
+        Impl* impl = pimpl_.get();
+        stages.finish  = [impl, eng, user](const std::vector<float>& emb, size_t dim,
+                                           const EnrollJob::Counts& counts,
+                                           bool cancelled) {
+            return impl->finish_enroll(eng, user, emb, dim, counts, cancelled);
+        };
 
-        while ((int)embeddings.size() < cfg_.enroll_target && attempts < 60) {
-            if (std::chrono::steady_clock::now() - start > std::chrono::seconds(45)) {
-                spdlog::warn("Enroll timeout for user '{}'", user);
-                break;
+        std::shared_ptr<EnrollJob> job;
+        {
+            std::lock_guard<std::mutex> lk(pimpl_->jobs_mtx);
+            for (auto it = pimpl_->jobs.begin(); it != pimpl_->jobs.end();) {
+                if (it->second->finished_for() > ENROLL_JOB_KEEP) {
+                    it = pimpl_->jobs.erase(it);
+                    continue;
+                }
+                if (it->second->user() == user && !it->second->done())
+                    return {{"v",2},{"ok",false},{"err","enroll_running"},
+                            {"job",it->first},
+                            {"hint","Wait for it with enroll_wait, or enroll_cancel it"}};
+                ++it;
             }
+            std::string id = std::to_string(++pimpl_->next_job);
+            job = std::make_shared<EnrollJob>(id, user, params, std::move(stages));
+            pimpl_->jobs.emplace(id, job);
+        }
+        job->start();
 
-            cv::Mat face;
-            if (!capture_face_bgr(face, cfg_.camera_device)) {
-                ++attempts;
-                continue;
-            }
+        if (req.value("async", false))
+            return {{"v",2},{"ok",true},{"job",job->id()},{"state","running"}};
 
-            if (!quality_ok(face)) {
-                ++quality_fails;
-                ++attempts;
-                if (quality_fails % 5 == 0)
-                    spdlog::info("Enroll '{}': {} quality rejects so far — "
-                                 "ensure good lighting and face the camera",
-                                 user, quality_fails);
-                continue;
-            }
+        json result = job->wait(emit, &cancel);
+        if (result.is_null()) {
+            // the client left: nobody wants this enrollment any more
+            job->cancel();
+            result = job->wait(nullptr);
+        }
+        return result;
+    }
+
+    // ---- AUTH ----
+    if (cmd == "auth") {
+        std::string gerr;
+        GalleryPtr stored = eng->galleries().get(user, &gerr);
+        if (!stored) {
+            audit("auth", user, false, -1.f, -1.f, gerr);
+            if (gerr == "not_enrolled")
+                return {{"v",2},{"ok",false},{"err","not_enrolled"},
+                        {"hint","Run: facelock enroll " + user}};
+            if (gerr == "model_mismatch")
+                return {{"v",2},{"ok",false},{"err","model_mismatch"},
+                        {"hint","The face model changed since enrollment. "
+                                "Run: facelock enroll " + user}};
+            return {{"v",2},{"ok",false},{"err","read_failed"}};
+        }
+
+        // Burst: score faces as they are embedded and stop as soon as the
+        // fused score clearly passes or clearly fails. Concurrent auths
+        // share the burst's frames; each scores its own gallery.
+        //
+        // With "deadline_ms" the client hands over its whole budget: bursts
+        // are retried until one matches or the budget runs out, and
+        // progress is streamed as events instead of the client
+        // reconnecting for every try. Without it one burst decides.
+        const int budget = std::clamp(req.value("deadline_ms", 0), 0,
+                                      AUTH_MAX_DEADLINE_MS);
+        const auto deadline = std::chrono::steady_clock::now() +
+                              std::chrono::milliseconds(budget);
 
-            // save raw sample for potential re-training later
-            cv::imwrite(
-                (userdir / (std::to_string(embeddings.size()) + ".png")).string(),
-                face
-            );
+        // adaptive mode: keep the best frame's embedding as the one to learn
+        const bool learn = cfg.adaptive_gallery;
+        // a burst never holds more than auth_burst_frames frames
+        const int min_frames = std::min(cfg.auth_burst_min, cfg.auth_burst_frames);
+        ScoreFusion fusion(cfg.onnx_threshold, cfg.auth_margin, min_frames);
+        std::vector<float> best_query;
+        float best_frame  = 1.f;
+        int   embed_fails = 0;
+        int   attempts    = 0;
+        bool  seen_face   = false;
 
-            auto emb = pimpl_->embed(face);
-            if (!emb.empty())
-                embeddings.push_back(std::move(emb));
+        // faces the helper dropped (blurred, dark, turned away...) in the
+        // bursts this request took part in; they were never embedded
+        CaptureRejects rejects;
 
+        while (true) {
             ++attempts;
-        }
+            fusion      = ScoreFusion(cfg.onnx_threshold, cfg.auth_margin, min_frames);
+            best_frame  = 1.f;
+            embed_fails = 0;
+            best_query.clear();
+            CaptureRejects attempt_rejects;
 
-        int got = (int)embeddings.size();
+            int timeout = cfg.auth_burst_ms;
+            if (attempts > 1)
+                timeout = std::min<long long>(timeout, ms_between(
+                    std::chrono::steady_clock::now(), deadline));
 
-        if (got < cfg_.enroll_min) {
-            audit("enroll", user, false, -1.f, -1.f,
-                  fmt::format("only {} samples captured", got));
-            return {{"v",2},{"ok",false},{"err","not_enough_faces"},{"got",got},
-                    {"need",cfg_.enroll_min},
-                    {"hint","Make sure the camera can see your face clearly, "
-                            "lighting is adequate, and hold still during enrollment."}};
+            pimpl_->capture->shared_burst(embed, eng->model_hash(),
+                                          [&](const BurstFrame& frame) {
+                if (frame.embedding.empty()) {
+                    ++embed_fails;
+                } else {
+                    if (!seen_face) {
+                        seen_face = true;
+                        emit({{"event","face_detected"}});
+                    }
+                    float d = top3_distance(frame.embedding, *stored);
+                    fusion.add(d);
+                    if (learn && d < best_frame) {
+                        best_frame = d;
+                        best_query = frame.embedding;
+                    }
+                    if (fusion.decided()) return false;
+                }
+                return fusion.frames() + embed_fails < cfg.auth_burst_frames;
+            }, timeout, &cancel, &attempt_rejects);
+            rejects.add(attempt_rejects);
+
+            if (fusion.accepted() || cancel.cancelled() ||
+                (fusion.frames() == 0 && embed_fails > 0) ||
+                ms_between(std::chrono::steady_clock::now(), deadline) <
+                    AUTH_MIN_RETRY_MS)
+                break;
+
+            if (fusion.frames() == 0)
+                emit({{"event","no_face"},{"attempt",attempts},{"rejects",attempt_rejects},
+                      {"hint",attempt_rejects.total() > 0 ? reject_hint(attempt_rejects)
+                                                          : "Look at the camera"}});
+            else
+                emit({{"event","no_match"},{"attempt",attempts},
+                      {"score",fusion.score()},{"hint","Look straight at the camera"}});
+        }
+
+        // nobody to answer: no verdict, and nothing learned from it
+        if (cancel.cancelled()) {
+            audit("auth", user, false, -1.f, cfg.onnx_threshold,
+                  fmt::format("cancelled frames={} attempts={}",
+                              fusion.frames(), attempts));
+            return {{"v",2},{"ok",false},{"err","cancelled"}};
         }
 
-        // write embedding file
-        fs::path emb_path = fs::path(cfg_.data_dir) / (user + "_onnx_emb.bin");
-        FILE* f = fopen(emb_path.c_str(), "wb");
-        if (!f) {
-            audit("enroll", user, false, -1.f, -1.f, "write_failed");
-            return {{"v",2},{"ok",false},{"err","write_failed"},
-                    {"hint","Check permissions on " + cfg_.data_dir}};
+        if (fusion.frames() == 0) {
+            if (embed_fails > 0) {
+                audit("auth", user, false, -1.f, cfg.onnx_threshold, "embed_failed");
+                return {{"v",2},{"ok",false},{"err","embed_failed"},{"match",false}};
+            }
+            audit("auth", user, false, -1.f, cfg.onnx_threshold,
+                  fmt::format("no_face_detected attempts={} quality_rejects={}",
+                              attempts, rejects.total()));
+            return {{"v",2},{"ok",false},{"err","no_face"},{"match",false},
+                    {"attempts",attempts},{"quality_rejects",rejects.total()},
+                    {"rejects",rejects},
+                    {"hint",rejects.total() > 0
+                                ? reject_hint(rejects)
+                                : "Position your face in front of the camera and try again"}};
         }
 
-        uint32_t N = (uint32_t)embeddings.size();
-        uint32_t D = (uint32_t)embeddings[0].size();
-        fwrite(&N, sizeof(N), 1, f);
-        fwrite(&D, sizeof(D), 1, f);
-        for (auto& e : embeddings)
-            fwrite(e.data(), sizeof(float), D, f);
-        fclose(f);
+        float score = fusion.score();
+        bool  match = fusion.accepted();
+        audit("auth", user, match, score, cfg.onnx_threshold,
+              fmt::format("frames={} attempts={}", fusion.frames(), attempts));
 
-        audit("enroll", user, true, -1.f, -1.f,
-              fmt::format("samples={} quality_rejects={}", N, quality_fails));
-        spdlog::info("Enrolled {} embeddings for user '{}' ({} quality rejects)",
-                     N, user, quality_fails);
+        // only clear passes teach the gallery, never borderline ones
+        const float teach = cfg.onnx_threshold - cfg.adaptive_margin;
+        if (learn && match && score <= teach && best_frame <= teach)
+            pimpl_->learn_async({eng, user, std::move(best_query), best_frame});
 
-        return {{"v",2},{"ok",true},{"samples",(int)N},{"quality_rejects",quality_fails}};
+        return {{"v",2},{"ok",true},{"match",match},{"score",score},
+                {"frames",fusion.frames()},{"attempts",attempts},
+                {"quality_rejects",rejects.total()},{"rejects",rejects},{"err",nullptr}};
     }
 
-    // ---- AUTH ----
-    if (cmd == "auth") {
-        fs::path emb_path = fs::path(cfg_.data_dir) / (user + "_onnx_emb.bin");
-        if (!fs::exists(emb_path)) {
-            audit("auth", user, false, -1.f, -1.f, "not_enrolled");
-            return {{"v",2},{"ok",false},{"err","not_enrolled"},
-                    {"hint","Run: facelock enroll " + user}};
+    // ---- IDENTIFY (1:N) ----
+    if (cmd == "identify") {
+        {
+            TraceSpan span("identify.refresh");
+            eng->templates->refresh_identities(cfg.data_dir);
+        }
+        IdentityIndex& index = eng->identities();
+        if (index.templates() == 0) {
+            audit("identify", "-", false, -1.f, -1.f, "no_enrollments");
+            return {{"v",2},{"ok",false},{"err","no_enrollments"},
+                    {"hint","Run: facelock enroll <user>"}};
         }
 
-        FILE* f = fopen(emb_path.c_str(), "rb");
-        if (!f) {
-            audit("auth", user, false, -1.f, -1.f, "read_failed");
-            return {{"v",2},{"ok",false},{"err","read_failed"}};
+        // Same burst as auth, fused per candidate user. The answer must
+        // be the best match on a majority of frames, so one frame that
+        // happens to land near someone else cannot pick the identity.
+        std::unordered_map<std::string, ScoreFusion> fused;
+        int frames = 0, embed_fails = 0;
+        int no_candidates = 0;   // embedded, but the index had nobody to offer
+
+        pimpl_->capture->shared_burst(embed, eng->model_hash(),
+                                      [&](const BurstFrame& frame) {
+            IdentityIndex::Match m;
+            bool found = false;
+            if (!frame.embedding.empty()) {
+                TraceSpan span("identify.search");
+                found = index.search(frame.embedding.data(), frame.embedding.size(), m);
+            }
+            if (frame.embedding.empty()) {
+                ++embed_fails;
+            } else if (!found) {
+                // dimension mismatch, or every candidate was removed
+                ++no_candidates;
+            } else {
+                ++frames;
+                auto& f = fused.try_emplace(m.user, cfg.onnx_threshold,
+                                            cfg.auth_margin,
+                                            std::min(cfg.auth_burst_min,
+                                                     cfg.auth_burst_frames)).first->second;
+                f.add(m.score);
+                if (f.decided() && f.frames() * 2 > frames) return false;
+            }
+            return frames + embed_fails + no_candidates < cfg.auth_burst_frames;
+        }, cfg.auth_burst_ms, &cancel);
+
+        if (cancel.cancelled()) {
+            audit("identify", "-", false, -1.f, cfg.onnx_threshold,
+                  fmt::format("cancelled frames={}", frames));
+            return {{"v",2},{"ok",false},{"err","cancelled"}};
         }
 
-        uint32_t N, D;
-        fread(&N, sizeof(N), 1, f);
-        fread(&D, sizeof(D), 1, f);
-        std::vector<std::vector<float>> stored(N, std::vector<float>(D));
-        for (auto& e : stored)
-            fread(e.data(), sizeof(float), D, f);
-        fclose(f);
-
-        cv::Mat face;
-        if (!capture_face_bgr(face, cfg_.camera_device)) {
-            audit("auth", user, false, -1.f, cfg_.onnx_threshold, "no_face_detected");
+        if (frames == 0) {
+            audit("identify", "-", false, -1.f, cfg.onnx_threshold,
+                  no_candidates > 0 ? "no_candidates"
+                  : embed_fails > 0 ? "embed_failed" : "no_face_detected");
+            if (no_candidates > 0)
+                return {{"v",2},{"ok",false},{"err","no_candidates"},{"match",false},
+                        {"hint","No enrollment matches the current face model. "
+                                "Run: facelock enroll <user>"}};
+            if (embed_fails > 0)
+                return {{"v",2},{"ok",false},{"err","embed_failed"},{"match",false}};
             return {{"v",2},{"ok",false},{"err","no_face"},{"match",false},
                     {"hint","Position your face in front of the camera and try again"}};
         }
 
-        auto query = pimpl_->embed(face);
-        if (query.empty()) {
-            audit("auth", user, false, -1.f, cfg_.onnx_threshold, "embed_failed");
-            return {{"v",2},{"ok",false},{"err","embed_failed"},{"match",false}};
-        }
-
-        // top-3 cosine distance average for stability
-        std::vector<float> dists;
-        dists.reserve(N);
-        for (auto& e : stored) {
-            float dot = 0.f, na = 0.f, nb = 0.f;
-            for (uint32_t i = 0; i < D; ++i) {
-                dot += query[i] * e[i];
-                na  += query[i] * query[i];
-                nb  += e[i]     * e[i];
+        const std::string* best = nullptr;
+        const ScoreFusion* bf   = nullptr;
+        for (const auto& [name, f] : fused) {
+            if (!bf || f.frames() > bf->frames() ||
+                (f.frames() == bf->frames() && f.score() < bf->score())) {
+                best = &name;
+                bf   = &f;
             }
-            dists.push_back(1.0f - dot / (std::sqrt(na * nb) + 1e-12f));
         }
-        std::sort(dists.begin(), dists.end());
-        int top = std::min(3, (int)dists.size());
-        float score = 0.f;
-        for (int i = 0; i < top; ++i) score += dists[i];
-        score /= top;
+        float score = bf->score();
+        bool  match = bf->accepted() && bf->frames() * 2 > frames;
+        audit("identify", match ? *best : "-", match, score, cfg.onnx_threshold,
+              fmt::format("frames={} candidates={}", frames, fused.size()));
+
+        return {{"v",2},{"ok",true},{"match",match},
+                {"user",match ? json(*best) : json(nullptr)},{"score",score},
+                {"frames",frames},{"err",nullptr}};
+    }
 
-        bool match = score <= cfg_.onnx_threshold;
-        audit("auth", user, match, score, cfg_.onnx_threshold);
+    // ---- ADAPTIVE GALLERY ----
+    if (cmd == "adapt_status") {
+        AdaptiveLog log;
+        read_adaptive(cfg.data_dir, user, eng->model_hash(), log);
+        json learned = json::array();
+        for (const auto& t : log.live)
+            learned.push_back({{"seq",t.seq},{"time",t.time},{"score",t.score}});
+        return {{"v",2},{"ok",true},{"enabled",cfg.adaptive_gallery},
+                {"max",cfg.adaptive_max},{"learned",learned}};
+    }
 
-        return {{"v",2},{"ok",true},{"match",match},{"score",score},{"err",nullptr}};
+    if (cmd == "adapt_rollback") {
+        if (!may_act_for(peer, user)) {
+            audit("adapt_rollback", user, false, -1.f, -1.f,
+                  fmt::format("denied uid={}", (long)peer.uid));
+            return {{"v",2},{"ok",false},{"err","permission_denied"},
+                    {"hint","Only root or " + user + " may roll back these templates"}};
+        }
+        size_t removed = 0;
+        {
+            std::lock_guard<std::mutex> lk(pimpl_->adapt_mtx);
+            AdaptiveLog log;
+            read_adaptive(cfg.data_dir, user, 0, log);
+            if (remove_adaptive(cfg.data_dir, user)) removed = log.live.size();
+        }
+        eng->galleries().invalidate(user);
+        audit("adapt_rollback", user, true, -1.f, -1.f,
+              fmt::format("removed={}", removed));
+        return {{"v",2},{"ok",true},{"removed",removed}};
     }
 
     // ---- PING ----
-    if (cmd == "ping")
-        return {{"v",2},{"ok",true},{"pong",true}};
+    if (cmd == "ping") {
+        auto gs = eng->galleries().stats();
+        auto cs = pimpl_->capture->stats();
+        return {{"v",2},{"ok",true},{"pong",true},{"generation",eng->generation},
+                {"gallery",{{"cached",gs.cached},{"hits",gs.hits},
+                            {"misses",gs.misses},{"invalidations",gs.invalidations}}},
+                {"camera",{{"bursts",cs.bursts},{"shared",cs.shared},
+                           {"frames",cs.frames},{"preemptions",cs.preemptions},
+                           {"skipped",cs.skipped},
+                           {"rejects",pimpl_->camera->rejects()}}},
+                {"cancel",{{"requests",pimpl_->cancelled.load()},
+                           {"left_capture",cs.cancelled},
+                           {"wasted_ms",pimpl_->wasted_ms.load()}}},
+                {"identify",{{"users",eng->identities().users()},
+                             {"templates",eng->identities().templates()},
+                             {"hnsw",eng->identities().graph()}}}};
+    }
 
     return {{"v",2},{"ok",false},{"err","unknown_cmd"},
-            {"hint","Valid commands: enroll, auth, ping"}};
+            {"hint","Valid commands: enroll, enroll_status, enroll_wait, "
+                   "enroll_cancel, auth, identify, adapt_status, "
+                   "adapt_rollback, reload, trace, ping"}};
+}
+
+// Trace span of a request. Span names are kept by pointer, so they
+// come from this table, never from the request itself.
+static const char* request_span(const json& req) {
+    static const char* const CMDS[] = {
+        "auth", "identify", "enroll", "enroll_status", "enroll_wait",
+        "enroll_cancel", "adapt_status", "adapt_rollback", "reload", "trace", "ping",
+    };
+    auto it = req.find("cmd");
+    if (it != req.end() && it->is_string())
+        for (const char* c : CMDS)
+            if (it->get_ref<const std::string&>() == c) return c;
+    return "request";
 }
 
 int Daemon::run() {
+    auto t0 = std::chrono::steady_clock::now();
+
+    // SIGHUP (reload) and SIGUSR1 (trace dump) are taken by sigwait()
+    // below; block them before any thread exists so none of them
+    // inherits the default (terminate) action
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGHUP);
+    sigaddset(&sigs, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+
+    // under a .socket unit the socket exists before we do: clients that
+    // connect while the model loads queue in it and are served once warm
+    int activated = sd_listen_fd();
+    if (activated >= 0) {
+        sockaddr_un addr{};
+        socklen_t   len = sizeof(addr);
+        if (getsockname(activated, reinterpret_cast<sockaddr*>(&addr), &len) == 0 &&
+            cfg_.socket_path != addr.sun_path)
+            spdlog::warn("Socket unit listens on {}, SOCKET_PATH ({}) is ignored",
+                         addr.sun_path, cfg_.socket_path);
+    }
+
     if (!initialize()) return 1;
 
-    IPCServer server(cfg_.socket_path);
-    server.start([this](const json& r) {
-        return handle_request(r);
-    });
+    IPCOptions ipc;
+    ipc.backlog         = cfg_.ipc_backlog;
+    ipc.workers         = (size_t)std::max(1, cfg_.ipc_workers);
+    ipc.max_queue       = ipc.workers * 8;
+    ipc.read_timeout_ms = cfg_.ipc_read_timeout_ms;
+    ipc.max_request     = (size_t)std::max(1024, cfg_.ipc_max_request);
+    ipc.listen_fd       = activated;
+
+    IPCServer server(cfg_.socket_path, ipc);
+    auto handler = [this](const json& r, const IPCServer::Emit& emit,
+                          const CancelToken& cancel, const PeerCred& peer) {
+        auto t0  = std::chrono::steady_clock::now();
+        TraceSpan span(trace_enabled() ? request_span(r) : nullptr);
+        json out = handle_request(r, emit, cancel, peer);
+        if (cancel.cancelled()) {
+            // the client left while this ran: everything it did was wasted
+            pimpl_->cancelled.fetch_add(1, std::memory_order_relaxed);
+            pimpl_->wasted_ms.fetch_add(
+                (uint64_t)ms_between(t0, std::chrono::steady_clock::now()),
+                std::memory_order_relaxed);
+        }
+        return out;
+    };
+    if (!server.start(handler)) {
+        spdlog::error("Cannot listen on {}", cfg_.socket_path);
+        return 1;
+    }
 
-    spdlog::info("Listening on {}", cfg_.socket_path);
-    while (true)
-        std::this_thread::sleep_for(std::chrono::seconds(60));
+    // ready = model loaded, sessions warm, socket accepting
+    long long ready_ms = ms_between(t0, std::chrono::steady_clock::now());
+    spdlog::info("Listening on {} (ready in {} ms)", cfg_.socket_path, ready_ms);
+    sd_notify_state("READY=1\nSTATUS=Ready in " + std::to_string(ready_ms) + " ms");
+    while (true) {
+        int sig = 0;
+        if (sigwait(&sigs, &sig) != 0) continue;
+        if (sig == SIGHUP) reload("SIGHUP");
+        if (sig == SIGUSR1) {
+            const std::string path = pimpl_->engine()->cfg.trace_file;
+            if (trace_write(path))
+                spdlog::info("Trace written to {}{}", path,
+                             trace_enabled() ? "" : " (tracing is off)");
+            else
+                spdlog::error("Cannot write trace to {}", path);
+        }
+    }
 }
@@ -0,0 +1,264 @@
+#include "facelock/enroll_job.h"
+#include "facelock/trace.h"
+
+#include <deque>
+#include <algorithm>
+#include <opencv2/imgcodecs.hpp>
+#include <spdlog/spdlog.h>
+
+using namespace facelock;
+using Clock = std::chrono::steady_clock;
+
+// How often wait() checks its caller's cancel token
+static constexpr auto WAIT_POLL = std::chrono::milliseconds(100);
+
+// ------------------------------------------------------------
+//  Bounded FIFO between two stages. push() blocks while full, so
+//  a slow stage throttles the one feeding it; pop() returns false
+//  once the queue is closed and drained.
+// ------------------------------------------------------------
+template <class T>
+class StageQueue {
+public:
+    explicit StageQueue(size_t capacity) : cap_(std::max<size_t>(1, capacity)) {}
+
+    bool push(T v) {
+        std::unique_lock<std::mutex> lk(mtx_);
+        not_full_.wait(lk, [&] { return closed_ || q_.size() < cap_; });
+        if (closed_) return false;
+        q_.push_back(std::move(v));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // wait for one item, then take whatever else is queued, up to `max`
+    bool pop(std::vector<T>& out, size_t max) {
+        out.clear();
+        std::unique_lock<std::mutex> lk(mtx_);
+        not_empty_.wait(lk, [&] { return closed_ || !q_.empty(); });
+        while (!q_.empty() && out.size() < max) {
+            out.push_back(std::move(q_.front()));
+            q_.pop_front();
+        }
+        not_full_.notify_all();
+        return !out.empty();
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lk(mtx_);
+        closed_ = true;
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+private:
+    size_t                  cap_;
+    std::mutex              mtx_;
+    std::condition_variable not_full_, not_empty_;
+    std::deque<T>           q_;
+    bool                    closed_ = false;
+};
+
+namespace {
+struct Sample {
+    int     index;   // acceptance order, names the PNG
+    cv::Mat bgr;
+};
+} // namespace
+
+EnrollJob::EnrollJob(std::string id, std::string user, const Params& params,
+                     Stages stages)
+    : id_(std::move(id)), user_(std::move(user)), params_(params),
+      stages_(std::move(stages)) {}
+
+EnrollJob::~EnrollJob() {
+    cancel();
+    if (thread_.joinable()) thread_.join();
+}
+
+void EnrollJob::start() {
+    started_ = Clock::now();
+    thread_  = std::thread(&EnrollJob::run, this);
+}
+
+bool EnrollJob::done() const {
+    std::lock_guard<std::mutex> lk(mtx_);
+    return done_;
+}
+
+Clock::duration EnrollJob::finished_for() const {
+    std::lock_guard<std::mutex> lk(mtx_);
+    return done_ ? Clock::now() - finished_ : Clock::duration::zero();
+}
+
+void EnrollJob::update(const std::function<void(Counts&)>& fn) {
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        fn(counts_);
+        ++changes_;
+    }
+    cv_.notify_all();
+}
+
+json EnrollJob::progress_locked() const {
+    return {{"event","progress"},{"job",id_},{"accepted",counts_.accepted},
+            {"target",params_.target},{"attempts",counts_.attempts()},
+            {"quality_rejects",counts_.rejects.total()},
+            {"rejects",counts_.rejects}};
+}
+
+json EnrollJob::status() const {
+    std::lock_guard<std::mutex> lk(mtx_);
+    std::string state = "running";
+    if (done_)
+        state = result_.value("ok", false)                    ? "done"
+              : result_.value("err", std::string()) == "cancelled" ? "cancelled"
+                                                                   : "failed";
+    auto end = done_ ? finished_ : Clock::now();
+    json out = {{"v",2},{"ok",true},{"job",id_},{"user",user_},{"state",state},
+                {"accepted",counts_.accepted},{"target",params_.target},
+                {"attempts",counts_.attempts()},
+                {"quality_rejects",counts_.rejects.total()},
+                {"rejects",counts_.rejects},
+                {"embedded",counts_.embedded},{"written",counts_.written},
+                {"elapsed_ms",std::chrono::duration_cast<std::chrono::milliseconds>(
+                                  end - started_).count()}};
+    if (done_) out["result"] = result_;
+    return out;
+}
+
+json EnrollJob::wait(const std::function<void(const json&)>& on_progress,
+                     const CancelToken* cancel) const {
+    std::unique_lock<std::mutex> lk(mtx_);
+    uint64_t seen = changes_;
+    json     last;
+    while (!done_) {
+        cv_.wait_for(lk, WAIT_POLL, [&] { return done_ || changes_ != seen; });
+        if (cancel && cancel->cancelled()) return nullptr;
+        if (done_ || changes_ == seen) continue;
+        seen = changes_;
+        json ev = progress_locked();
+        if (ev == last) continue;   // only embedded/written moved
+        last = ev;
+        lk.unlock();
+        if (on_progress) on_progress(ev);
+        lk.lock();
+    }
+    return result_;
+}
+
+// ============================================================
+//  Pipeline
+// ============================================================
+void EnrollJob::run() {
+    StageQueue<Sample> to_embed((size_t)params_.queue);
+    StageQueue<Sample> to_write((size_t)params_.queue);
+    spdlog::info("Enroll job {} started for user '{}'", id_, user_);
+
+    // ---- embed: whatever has queued up goes in one batch ----
+    std::vector<float> embeddings;
+    size_t             dim = 0;
+    std::thread embed([&] {
+        std::vector<Sample> batch;
+        std::vector<cv::Mat> faces;
+        while (to_embed.pop(batch, (size_t)std::max(1, params_.batch))) {
+            if (cancel_.cancelled()) continue;
+            faces.clear();
+            for (auto& s : batch) faces.push_back(s.bgr);
+
+            cv::Mat rows = stages_.embed(faces);
+            if (rows.empty() || rows.rows != (int)faces.size() ||
+                (dim && (size_t)rows.cols != dim)) {
+                spdlog::warn("Enroll '{}': embedding a batch of {} failed",
+                             user_, faces.size());
+                continue;
+            }
+            dim = (size_t)rows.cols;
+            for (int r = 0; r < rows.rows; ++r) {
+                const float* p = rows.ptr<float>(r);
+                embeddings.insert(embeddings.end(), p, p + dim);
+            }
+            update([&](Counts& c) { c.embedded += rows.rows; });
+        }
+    });
+
+    // ---- persist: raw samples, for re-training later ----
+    std::thread persist([&] {
+        std::vector<Sample> batch;
+        while (to_write.pop(batch, 1)) {
+            if (cancel_.cancelled()) continue;
+            const Sample& s = batch.front();
+            std::string path = params_.sample_dir + "/" + std::to_string(s.index) + ".png";
+            TraceSpan span("enroll.write");
+            if (cv::imwrite(path, s.bgr))
+                update([](Counts& c) { ++c.written; });
+            else
+                spdlog::warn("Enroll '{}': cannot write {}", user_, path);
+        }
+    });
+
+    // ---- capture, on this thread: only hands faces on; the helper has
+    // checked them ----
+    // Rejected faces never reach the daemon, so a scene where nothing
+    // passes (too dark, too far) is ended after max_attempts faces. Only
+    // this job's stream counts: faces dropped while it is paused for an
+    // auth belong to the auth.
+    int accepted = 0;
+    int rejects_logged = 0;
+    stages_.capture([&](CapturedFace& face) {
+        int index = accepted++;
+        int attempts = 0;
+        update([&](Counts& c) {
+            c.seen += face.window;
+            ++c.accepted;
+            attempts = c.attempts();
+        });
+        if (attempts >= params_.max_attempts) stop_.cancel();
+        to_embed.push({index, face.bgr});
+        if (!params_.sample_dir.empty())
+            to_write.push({index, std::move(face.bgr)});
+        return accepted < params_.target && !stop_.cancelled();
+    }, params_.timeout_ms, &stop_, [&](const CaptureRejects& dropped) {
+        int attempts = 0, total = 0;
+        update([&](Counts& c) {
+            c.rejects.add(dropped);
+            attempts = c.attempts();
+            total    = (int)c.rejects.total();
+        });
+        if (total / 5 > rejects_logged / 5) {
+            spdlog::info("Enroll '{}': {} quality rejects so far — "
+                         "ensure good lighting and face the camera",
+                         user_, total);
+            rejects_logged = total;
+        }
+        if (attempts >= params_.max_attempts) stop_.cancel();
+    });
+    to_embed.close();
+    to_write.close();
+    embed.join();
+    persist.join();
+
+    bool cancelled = cancel_.cancelled();
+    Counts counts;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        counts = counts_;
+    }
+    if (!cancelled && counts.accepted < params_.target &&
+        counts.attempts() < params_.max_attempts)
+        spdlog::warn("Enroll timeout for user '{}'", user_);
+
+    json result = stages_.finish(embeddings, dim, counts, cancelled);
+    result["job"] = id_;
+
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        result_   = std::move(result);
+        done_     = true;
+        finished_ = Clock::now();
+    }
+    cv_.notify_all();
+    spdlog::info("Enroll job {} finished in {} ms", id_,
+                 std::chrono::duration_cast<std::chrono::milliseconds>(
+                     finished_ - started_).count());
+}
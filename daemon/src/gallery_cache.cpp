@@ -0,0 +1,149 @@
+#include "facelock/gallery_cache.h"
+#include "facelock/trace.h"
+
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <spdlog/spdlog.h>
+
+using namespace facelock;
+
+// ------------------------------------------------------------
+//  Cache
+// ------------------------------------------------------------
+GalleryCache::GalleryCache(const std::string& data_dir, uint64_t model_hash,
+                           bool adaptive)
+    : data_dir_(data_dir), model_hash_(model_hash), adaptive_(adaptive) {
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    stop_fd_    = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inotify_fd_ >= 0 && stop_fd_ >= 0 &&
+        inotify_add_watch(inotify_fd_, data_dir_.c_str(),
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                          IN_DELETE | IN_CREATE | IN_DELETE_SELF | IN_MOVE_SELF) >= 0) {
+        watcher_ = std::thread(&GalleryCache::watch_loop, this);
+    } else {
+        // still correct, just relies on explicit invalidation
+        spdlog::warn("inotify unavailable on {}, gallery cache only "
+                     "refreshes on explicit reload", data_dir_);
+    }
+}
+
+GalleryCache::~GalleryCache() {
+    if (watcher_.joinable()) {
+        uint64_t one = 1;
+        (void)!write(stop_fd_, &one, sizeof(one));
+        watcher_.join();
+    }
+    if (inotify_fd_ >= 0) close(inotify_fd_);
+    if (stop_fd_ >= 0)    close(stop_fd_);
+}
+
+GalleryPtr GalleryCache::get(const std::string& user, std::string* err) {
+    uint64_t gen;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto it = entries_.find(user);
+        if (it != entries_.end()) {
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            if (!it->second.gallery && err) *err = it->second.err;
+            return it->second.gallery;
+        }
+        gen = generation_;
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+
+    // read outside the lock so one slow load does not stall other users
+    TraceSpan span("gallery.load");
+    std::string e;
+    GalleryPtr g = load_gallery(data_dir_, user, model_hash_, e);
+    AdaptiveLog learned;
+    if (g && adaptive_ && read_adaptive(data_dir_, user, model_hash_, learned)) {
+        if (GalleryPtr merged = merge_adaptive(*g, learned))
+            g = std::move(merged);
+    }
+    if (g)
+        spdlog::debug("Gallery for '{}' loaded ({} x {}, {} learned)", user,
+                      g->size(), g->dim(), learned.live.size());
+
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        // an invalidation that raced with the read wins; read errors are
+        // not cached so the next request retries
+        if (generation_ == gen && e != "read_failed")
+            entries_[user] = {g, e};
+    }
+    if (!g && err) *err = e;
+    return g;
+}
+
+void GalleryCache::invalidate(const std::string& user) {
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        ++generation_;
+        if (entries_.erase(user))
+            invalidations_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (listener_) listener_(user);
+}
+
+void GalleryCache::clear() {
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        ++generation_;
+        invalidations_.fetch_add(entries_.size(), std::memory_order_relaxed);
+        entries_.clear();
+    }
+    if (listener_) listener_("");
+}
+
+GalleryCache::Stats GalleryCache::stats() const {
+    std::lock_guard<std::mutex> lk(mtx_);
+    return {hits_.load(std::memory_order_relaxed),
+            misses_.load(std::memory_order_relaxed),
+            invalidations_.load(std::memory_order_relaxed),
+            entries_.size()};
+}
+
+// ------------------------------------------------------------
+//  inotify watcher
+// ------------------------------------------------------------
+void GalleryCache::watch_loop() {
+    alignas(inotify_event) char buf[4096];
+    pollfd fds[2] = {{inotify_fd_, POLLIN, 0}, {stop_fd_, POLLIN, 0}};
+
+    while (true) {
+        int pr = poll(fds, 2, -1);
+        if (pr < 0 && errno == EINTR) continue;
+        if (pr < 0 || (fds[1].revents & POLLIN)) return;
+
+        ssize_t len;
+        while ((len = read(inotify_fd_, buf, sizeof(buf))) > 0) {
+            for (char* p = buf; p < buf + len; ) {
+                auto* ev = reinterpret_cast<inotify_event*>(p);
+                p += sizeof(inotify_event) + ev->len;
+
+                if (ev->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                    clear();
+                    continue;
+                }
+                if (!ev->len) continue;
+
+                std::string name(ev->name);
+                for (const char* suffix : {GALLERY_SUFFIX, ADAPT_SUFFIX}) {
+                    const size_t sl = std::strlen(suffix);
+                    if (name.size() > sl && name[0] != '.' &&
+                        name.compare(name.size() - sl, sl, suffix) == 0) {
+                        std::string user = name.substr(0, name.size() - sl);
+                        spdlog::debug("Gallery for '{}' changed on disk", user);
+                        invalidate(user);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,341 @@
+#include "facelock/identity_index.h"
+#include "facelock/similarity.h"
+
+#include <cmath>
+#include <chrono>
+#include <mutex>
+#include <queue>
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+using namespace facelock;
+
+// Candidate users re-scored exactly after a graph search. A user's top-3
+// mean is dominated by their nearest template, which the graph finds
+// reliably; the exact pass only has to order a handful of users.
+static constexpr size_t RERANK_USERS = 4;
+
+// Tombstones tolerated before storage is compacted and the graph rebuilt
+static constexpr size_t MIN_COMPACT = 256;
+
+using Cand = std::pair<float, uint32_t>;   // distance, node
+
+IdentityIndex::IdentityIndex(const Params& p) : params_(p) {
+    params_.M               = std::max(2, params_.M);
+    params_.ef_construction = std::max(params_.M, params_.ef_construction);
+    params_.ef_search       = std::max(1, params_.ef_search);
+}
+
+size_t IdentityIndex::users() const {
+    std::shared_lock<std::shared_mutex> lk(mtx_);
+    return user_ids_.size();
+}
+
+size_t IdentityIndex::templates() const {
+    std::shared_lock<std::shared_mutex> lk(mtx_);
+    return live_;
+}
+
+bool IdentityIndex::graph() const {
+    std::shared_lock<std::shared_mutex> lk(mtx_);
+    return graph_;
+}
+
+float IdentityIndex::distance(const float* q, uint32_t i) const {
+    return 1.f - dot(q, vec(i), dim_);
+}
+
+float IdentityIndex::user_score(const float* q, const User& u) const {
+    float best[3];
+    size_t top = top_k_distances(q, vec(u.first), u.count, dim_, 3, best);
+    float score = 0.f;
+    for (size_t i = 0; i < top; ++i) score += best[i];
+    return top > 0 ? score / top : 1.f;
+}
+
+// ------------------------------------------------------------
+//  Updates
+// ------------------------------------------------------------
+void IdentityIndex::set_user(const std::string& user, const Gallery& g) {
+    if (g.size() == 0) { remove_user(user); return; }
+
+    std::unique_lock<std::shared_mutex> lk(mtx_);
+    if (dim_ == 0) dim_ = g.dim();
+    if (g.dim() != dim_) {
+        spdlog::warn("Identify index: '{}' has {}-dim templates, index is {}-dim",
+                     user, g.dim(), dim_);
+        return;
+    }
+
+    uint32_t uid;
+    auto it = user_ids_.find(user);
+    if (it != user_ids_.end()) {
+        uid = it->second;
+        drop_locked(uid);
+    } else {
+        uid = (uint32_t)users_.size();
+        users_.push_back(User{user});
+        user_ids_.emplace(user, uid);
+    }
+
+    // templates are appended as f32 whatever the gallery dtype, so one
+    // kernel scores every user
+    uint32_t first = (uint32_t)nodes_.size();
+    const size_t n = g.size();
+    vecs_.resize(vecs_.size() + n * dim_);
+    float* dst = vecs_.data() + (size_t)first * dim_;
+    for (size_t r = 0; r < n; ++r, dst += dim_) {
+        switch (g.dtype()) {
+        case GALLERY_F16: {
+            auto* row = static_cast<const uint16_t*>(g.rows()) + r * dim_;
+            for (size_t j = 0; j < dim_; ++j) dst[j] = half_to_float(row[j]);
+            break;
+        }
+        case GALLERY_I8: {
+            auto* row = static_cast<const int8_t*>(g.rows()) + r * dim_;
+            float s = g.scales()[r];
+            for (size_t j = 0; j < dim_; ++j) dst[j] = row[j] * s;
+            break;
+        }
+        default: {
+            auto* row = static_cast<const float*>(g.rows()) + r * dim_;
+            std::copy(row, row + dim_, dst);
+        }
+        }
+        nodes_.emplace_back(uid);
+    }
+
+    User& u = users_[uid];
+    u.first = first;
+    u.count = (uint32_t)n;
+    u.live  = true;
+    live_  += n;
+
+    if (deleted_ >= MIN_COMPACT && deleted_ > live_) {
+        compact_locked();          // rebuilds the graph if active
+    } else if (graph_) {
+        for (uint32_t id = first; id < first + n; ++id) link_locked(id);
+    } else if (live_ > params_.brute_max) {
+        compact_locked();
+        build_graph_locked();
+    }
+}
+
+void IdentityIndex::remove_user(const std::string& user) {
+    std::unique_lock<std::shared_mutex> lk(mtx_);
+    auto it = user_ids_.find(user);
+    if (it == user_ids_.end()) return;
+    drop_locked(it->second);
+    if (deleted_ >= MIN_COMPACT && deleted_ > live_) compact_locked();
+}
+
+void IdentityIndex::drop_locked(uint32_t uid) {
+    User& u = users_[uid];
+    if (!u.live) return;
+    for (uint32_t id = u.first; id < u.first + u.count; ++id)
+        nodes_[id].deleted = true;
+    live_    -= u.count;
+    deleted_ += u.count;
+    u.live    = false;
+    u.count   = 0;
+}
+
+// Drop tombstoned nodes and users; node ids change, so the graph (if
+// any) is rebuilt from scratch.
+void IdentityIndex::compact_locked() {
+    std::vector<float> vecs;
+    std::vector<Node>  nodes;
+    std::vector<User>  users;
+    vecs.reserve(live_ * dim_);
+    nodes.reserve(live_);
+    user_ids_.clear();
+
+    for (const User& old : users_) {
+        if (!old.live) continue;
+        uint32_t uid = (uint32_t)users.size();
+        User u{old.name, (uint32_t)nodes.size(), old.count, true};
+        const float* src = vec(old.first);
+        vecs.insert(vecs.end(), src, src + (size_t)old.count * dim_);
+        for (uint32_t i = 0; i < old.count; ++i) nodes.emplace_back(uid);
+        user_ids_.emplace(u.name, uid);
+        users.push_back(std::move(u));
+    }
+
+    vecs_.swap(vecs);
+    nodes_.swap(nodes);
+    users_.swap(users);
+    deleted_ = 0;
+    if (graph_) build_graph_locked();
+}
+
+// ============================================================
+//  HNSW
+// ============================================================
+void IdentityIndex::build_graph_locked() {
+    auto t0 = std::chrono::steady_clock::now();
+    graph_     = true;
+    max_level_ = -1;
+    for (Node& n : nodes_) n.links.clear();
+    for (uint32_t id = 0; id < (uint32_t)nodes_.size(); ++id)
+        if (!nodes_[id].deleted) link_locked(id);
+    spdlog::info("Identify index: graph built over {} templates ({} users) in {} ms",
+                 live_, user_ids_.size(),
+                 std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - t0).count());
+}
+
+// Per-thread visited marks: a node is visited when mark == epoch, so
+// clearing between searches is a counter bump.
+static thread_local std::vector<uint32_t> tl_marks;
+static thread_local uint32_t              tl_epoch = 0;
+
+std::vector<Cand>
+IdentityIndex::search_layer(const float* q, uint32_t entry,
+                            size_t ef, int layer) const {
+    if (tl_marks.size() < nodes_.size()) tl_marks.resize(nodes_.size(), 0);
+    if (++tl_epoch == 0) {
+        std::fill(tl_marks.begin(), tl_marks.end(), 0);
+        tl_epoch = 1;
+    }
+
+    // candidates: nearest first; results: farthest on top, capped at ef
+    std::priority_queue<Cand, std::vector<Cand>, std::greater<Cand>> cand;
+    std::priority_queue<Cand>                                        res;
+
+    float d0 = distance(q, entry);
+    cand.emplace(d0, entry);
+    res.emplace(d0, entry);
+    tl_marks[entry] = tl_epoch;
+
+    while (!cand.empty()) {
+        Cand c = cand.top();
+        if (c.first > res.top().first && res.size() >= ef) break;
+        cand.pop();
+
+        const Node& n = nodes_[c.second];
+        if ((int)n.links.size() <= layer) continue;
+        for (uint32_t nb : n.links[layer]) {
+            if (tl_marks[nb] == tl_epoch) continue;
+            tl_marks[nb] = tl_epoch;
+            float d = distance(q, nb);
+            if (res.size() < ef || d < res.top().first) {
+                cand.emplace(d, nb);
+                res.emplace(d, nb);
+                if (res.size() > ef) res.pop();
+            }
+        }
+    }
+
+    std::vector<Cand> out(res.size());
+    for (size_t i = out.size(); i-- > 0; res.pop()) out[i] = res.top();
+    return out;
+}
+
+void IdentityIndex::link_locked(uint32_t id) {
+    const size_t M = (size_t)params_.M;
+    const float* q = vec(id);
+
+    // level ~ floor(-ln(U) * mL), mL = 1 / ln(M)
+    std::uniform_real_distribution<double> uni(0.0, 1.0);
+    double u = std::max(uni(rng_), 1e-12);
+    int level = std::min((int)(-std::log(u) / std::log((double)M)), 16);
+    nodes_[id].links.assign((size_t)level + 1, {});
+
+    if (max_level_ < 0) {
+        entry_     = id;
+        max_level_ = level;
+        return;
+    }
+
+    // greedy descent through the layers above the new node's level
+    uint32_t ep = entry_;
+    for (int l = max_level_; l > level; --l) {
+        float best = distance(q, ep);
+        for (bool moved = true; moved;) {
+            moved = false;
+            for (uint32_t nb : nodes_[ep].links[l]) {
+                float d = distance(q, nb);
+                if (d < best) { best = d; ep = nb; moved = true; }
+            }
+        }
+    }
+
+    for (int l = std::min(level, max_level_); l >= 0; --l) {
+        std::vector<Cand> found = search_layer(q, ep, (size_t)params_.ef_construction, l);
+        const size_t cap = l == 0 ? 2 * M : M;
+
+        auto& mine = nodes_[id].links[l];
+        for (size_t i = 0; i < found.size() && mine.size() < M; ++i)
+            if (found[i].second != id) mine.push_back(found[i].second);
+
+        // back links; an overfull list keeps its `cap` closest neighbours
+        for (uint32_t nb : mine) {
+            auto& theirs = nodes_[nb].links[l];
+            theirs.push_back(id);
+            if (theirs.size() <= cap) continue;
+            const float* p = vec(nb);
+            std::vector<Cand> scored;
+            scored.reserve(theirs.size());
+            for (uint32_t t : theirs) scored.emplace_back(distance(p, t), t);
+            std::partial_sort(scored.begin(), scored.begin() + cap, scored.end());
+            theirs.resize(cap);
+            for (size_t i = 0; i < cap; ++i) theirs[i] = scored[i].second;
+        }
+        ep = found.front().second;
+    }
+
+    if (level > max_level_) {
+        entry_     = id;
+        max_level_ = level;
+    }
+}
+
+// ------------------------------------------------------------
+//  Search
+// ------------------------------------------------------------
+bool IdentityIndex::search(const float* query, size_t dim, Match& out) const {
+    std::shared_lock<std::shared_mutex> lk(mtx_);
+    if (live_ == 0 || dim != dim_) return false;
+
+    const User* best = nullptr;
+    float best_score = 2.f;
+    auto consider = [&](const User& u) {
+        float s = user_score(query, u);
+        if (s < best_score) { best_score = s; best = &u; }
+    };
+
+    if (!graph_) {
+        for (const User& u : users_)
+            if (u.live) consider(u);
+    } else {
+        uint32_t ep = entry_;
+        for (int l = max_level_; l > 0; --l) {
+            float d = distance(query, ep);
+            for (bool moved = true; moved;) {
+                moved = false;
+                for (uint32_t nb : nodes_[ep].links[l]) {
+                    float dn = distance(query, nb);
+                    if (dn < d) { d = dn; ep = nb; moved = true; }
+                }
+            }
+        }
+
+        // tombstoned nodes still route the search but are never returned
+        std::vector<Cand> found = search_layer(query, ep, (size_t)params_.ef_search, 0);
+        uint32_t picked[RERANK_USERS];
+        size_t   n = 0;
+        for (const Cand& c : found) {
+            const Node& node = nodes_[c.second];
+            if (node.deleted) continue;
+            if (std::find(picked, picked + n, node.owner) != picked + n) continue;
+            picked[n++] = node.owner;
+            consider(users_[node.owner]);
+            if (n == RERANK_USERS) break;
+        }
+    }
+
+    if (!best) return false;
+    out.user  = best->name;
+    out.score = best_score;
+    return true;
+}
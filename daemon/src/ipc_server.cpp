@@ -1,119 +1,533 @@
 #include "facelock/ipc_server.h"
+#include "facelock/ipc_protocol.h"
+#include "facelock/worker_pool.h"
 
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
 
-#include <thread>
+#include <cerrno>
+#include <chrono>
 #include <cstring>
+#include <algorithm>
 #include <filesystem>
-#include <sys/wait.h>
+#include <spdlog/spdlog.h>
 
 using namespace facelock;
 namespace fs = std::filesystem;
 
-IPCServer::IPCServer(const std::string& socket_path)
-    : socket_path_(socket_path), server_fd_(-1), running_(false) {}
+// epoll user data of the two non-connection fds
+static constexpr uint64_t LISTEN_ID = 0;
+static constexpr uint64_t WAKE_ID   = 1;
+
+static int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Serialise a response for the connection's framing
+static std::string encode(const json& resp, uint8_t format, bool framed) {
+    std::string body;
+    if (format == IPC_FORMAT_CBOR) {
+        std::vector<uint8_t> cbor = json::to_cbor(resp);
+        body.assign(cbor.begin(), cbor.end());
+    } else {
+        body = resp.dump();
+    }
+    if (!framed) {
+        body.push_back('\n');
+        return body;
+    }
+    IpcFrameHeader h;
+    h.magic[0] = IPC_FRAME_MAGIC0;
+    h.magic[1] = IPC_FRAME_MAGIC1;
+    h.format   = format;
+    h.flags    = 0;
+    h.length   = (uint32_t)body.size();
+    std::string out(reinterpret_cast<const char*>(&h), sizeof(h));
+    out += body;
+    return out;
+}
+
+IPCServer::IPCServer(const std::string& socket_path, const IPCOptions& opts)
+    : socket_path_(socket_path), opts_(opts) {}
 
 IPCServer::~IPCServer() { stop(); }
 
 bool IPCServer::start(const Handler& handler) {
     if (running_) return false;
+    handler_ = handler;
 
-    fs::path p(socket_path_);
-    if (p.has_parent_path())
-        fs::create_directories(p.parent_path());
+    signal(SIGPIPE, SIG_IGN);
 
-    ::unlink(socket_path_.c_str());
+    if (opts_.listen_fd >= 0) {
+        // socket activation: bound and listening already, and the path
+        // belongs to the .socket unit, which keeps queueing connections
+        // while the daemon restarts
+        server_fd_ = opts_.listen_fd;
+        inherited_ = true;
+        int fl = fcntl(server_fd_, F_GETFL);
+        if (fl < 0 || fcntl(server_fd_, F_SETFL, fl | O_NONBLOCK) < 0) {
+            server_fd_ = -1;
+            return false;
+        }
+    } else {
+        fs::path p(socket_path_);
+        if (p.has_parent_path())
+            fs::create_directories(p.parent_path());
 
-    server_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (server_fd_ < 0) return false;
+        ::unlink(socket_path_.c_str());
 
-    signal(SIGPIPE, SIG_IGN);
-    signal(SIGCHLD, SIG_IGN);
+        server_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (server_fd_ < 0) return false;
 
-    sockaddr_un addr{};
-    addr.sun_family = AF_UNIX;
-    std::strncpy(addr.sun_path, socket_path_.c_str(), sizeof(addr.sun_path) - 1);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, socket_path_.c_str(), sizeof(addr.sun_path) - 1);
 
-    if (bind(server_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
-        close(server_fd_);
-        return false;
-    }
+        if (bind(server_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+            close(server_fd_);
+            server_fd_ = -1;
+            return false;
+        }
 
-    chmod(socket_path_.c_str(), 0666);
+        chmod(socket_path_.c_str(), 0666);
+    }
 
-    if (listen(server_fd_, 16) < 0) {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event lev{}, wev{};
+    lev.events   = EPOLLIN;
+    lev.data.u64 = LISTEN_ID;
+    wev.events   = EPOLLIN;
+    wev.data.u64 = WAKE_ID;
+    if ((!inherited_ && listen(server_fd_, std::max(1, opts_.backlog)) < 0) ||
+        epoll_fd_ < 0 || wake_fd_ < 0 ||
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, server_fd_, &lev) < 0 ||
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &wev) < 0) {
+        if (epoll_fd_ >= 0) close(epoll_fd_);
+        if (wake_fd_ >= 0)  close(wake_fd_);
         close(server_fd_);
-        ::unlink(socket_path_.c_str());
+        epoll_fd_ = wake_fd_ = server_fd_ = -1;
+        if (!inherited_) ::unlink(socket_path_.c_str());
         return false;
     }
 
+    pool_    = std::make_unique<WorkerPool>(opts_.workers, opts_.max_queue);
     running_ = true;
-    std::thread(&IPCServer::accept_loop, this, handler).detach();
+    loop_    = std::thread(&IPCServer::event_loop, this);
+    spdlog::info("IPC: {} workers, {}, max request {} bytes, read timeout {} ms",
+                 pool_->threads(),
+                 inherited_ ? std::string("socket-activated listener")
+                            : fmt::format("backlog {}", opts_.backlog),
+                 opts_.max_request, opts_.read_timeout_ms);
     return true;
 }
 
 void IPCServer::stop() {
+    if (!running_) return;
     running_ = false;
-    if (server_fd_ >= 0) close(server_fd_);
-    ::unlink(socket_path_.c_str());
-}
 
-void IPCServer::accept_loop(Handler handler) {
-    while (running_) {
-        int client = accept(server_fd_, nullptr, nullptr);
-        if (client < 0) continue;
+    {
+        std::lock_guard<std::mutex> lk(done_mtx_);
+        stopping_ = true;
+    }
+    uint64_t one = 1;
+    (void)!write(wake_fd_, &one, sizeof(one));
+    if (loop_.joinable()) loop_.join();
+    for (auto& kv : conns_) kv.second.cancel->cancel();
+    pool_.reset();   // finishes handlers already running
 
-        pid_t pid = fork();
-        if (pid < 0) { close(client); continue; }
+    for (auto& kv : conns_) close(kv.second.fd);
+    conns_.clear();
+    close(server_fd_);
+    close(epoll_fd_);
+    close(wake_fd_);
+    server_fd_ = epoll_fd_ = wake_fd_ = -1;
+    if (!inherited_) ::unlink(socket_path_.c_str());
+}
 
-        if (pid == 0) {
-            close(server_fd_);
+// ------------------------------------------------------------
+//  Event loop
+// ------------------------------------------------------------
+void IPCServer::event_loop() {
+    epoll_event events[64];
+    while (true) {
+        // sleep until the nearest connection deadline
+        int64_t now  = now_ms();
+        int64_t next = -1;
+        for (const auto& kv : conns_) {
+            int64_t d = deadline(kv.second);
+            if (d >= 0 && (next < 0 || d < next)) next = d;
+        }
+        int timeout = next < 0 ? -1 : (int)std::max<int64_t>(0, next - now);
 
-            std::string data;
-            char buf[1024];
-            while (true) {
-                ssize_t r = read(client, buf, sizeof(buf));
-                if (r <= 0) break;
-                data.append(buf, (size_t)r);
-                if (data.find('\n') != std::string::npos) break;
-            }
+        int n = epoll_wait(epoll_fd_, events, 64, timeout);
+        if (n < 0 && errno != EINTR) {
+            spdlog::error("IPC: epoll_wait failed: {}", std::strerror(errno));
+            return;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            uint64_t id = events[i].data.u64;
+            uint32_t ev = events[i].events;
 
-            nlohmann::json resp;
-            try {
-                auto req = nlohmann::json::parse(data);
-
-                // v2 protocol: reject mismatched version but stay backward compatible
-                // v1 clients (no "v" field) are still accepted
-                int ver = req.value("v", 1);
-                if (ver > 2) {
-                    resp = {{"v",2},{"ok",false},{"err","unsupported_version"}};
-                } else {
-                    resp = handler(req);
+            if (id == LISTEN_ID) { on_accept(); continue; }
+            if (id == WAKE_ID) {
+                uint64_t v;
+                (void)!read(wake_fd_, &v, sizeof(v));
+                {
+                    std::lock_guard<std::mutex> lk(done_mtx_);
+                    if (stopping_) return;
                 }
-            } catch (const std::exception& e) {
-                resp = {{"v",2},{"ok",false},{"err",
-                    std::string("parse_error: ") + e.what()}};
+                collect_done();
+                continue;
             }
 
-            std::string out = resp.dump();
-            out.push_back('\n');
+            auto it = conns_.find(id);
+            if (it == conns_.end()) continue;
+            Conn& c = it->second;
 
-            ssize_t total = 0;
-            while (total < (ssize_t)out.size()) {
-                ssize_t w = send(client, out.data() + total,
-                                 out.size() - total, MSG_NOSIGNAL);
-                if (w <= 0) break;
-                total += w;
-            }
+            // peer gone (closed, not just half-closed after its request):
+            // work in flight is cancelled and its replies dropped on arrival
+            if (ev & (EPOLLHUP | EPOLLERR)) { close_conn(id); continue; }
+            if ((ev & EPOLLOUT) && !flush(id, c)) continue;
+            if (ev & (EPOLLIN | EPOLLRDHUP)) on_readable(id, c);
+        }
+        expire(now_ms());
+    }
+}
+
+void IPCServer::on_accept() {
+    while (true) {
+        int fd = accept4(server_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                spdlog::warn("IPC: accept failed: {}", std::strerror(errno));
+            return;
+        }
+
+        if (conns_.size() >= opts_.max_connections) {
+            std::string line = encode({{"v",2},{"ok",false},{"err","busy"},
+                                       {"hint","Too many connections, retry shortly"}},
+                                      IPC_FORMAT_JSON, false);
+            (void)!send(fd, line.data(), line.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+            close(fd);
+            continue;
+        }
+
+        uint64_t id = next_id_++;
+        epoll_event ev{};
+        ev.events   = EPOLLIN | EPOLLRDHUP;
+        ev.data.u64 = id;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            continue;
+        }
+        Conn c;
+        c.fd        = fd;
+        c.events    = ev.events;
+        c.active_ms = now_ms();
+        c.cancel    = std::make_shared<CancelToken>();
+        ucred cred{};
+        socklen_t len = sizeof(cred);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0) {
+            c.peer.uid = cred.uid;
+            c.peer.pid = cred.pid;
+        }
+        conns_.emplace(id, std::move(c));
+    }
+}
+
+void IPCServer::on_readable(uint64_t id, Conn& c) {
+    char buf[4096];
+    bool eof = false;
+    const size_t cap = opts_.max_request + sizeof(IpcFrameHeader);
+    while (c.in.size() <= cap) {
+        ssize_t r = read(c.fd, buf, sizeof(buf));
+        if (r > 0) { c.in.append(buf, (size_t)r); continue; }
+        if (r == 0) { eof = true; break; }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        close_conn(id);
+        return;
+    }
+    if (c.in.empty() && !eof) return;
+    c.active_ms = now_ms();
+
+    if (c.framing == Framing::Unknown && !c.in.empty())
+        c.framing = (uint8_t)c.in[0] == IPC_FRAME_MAGIC0 ? Framing::Binary
+                                                         : Framing::Line;
+
+    // dispatch every complete request, up to the pipelining limit
+    bool consumed = false;
+    while (!c.closing && (size_t)c.inflight < opts_.max_inflight) {
+        Message m;
+        const char* err = nullptr;
+        if (!next_message(c, m, err)) {
+            if (err) { fail(id, c, err, nullptr, true); return; }
+            break;
+        }
+        consumed = true;
+        dispatch(id, c, std::move(m));
+    }
+    if (c.in.empty())                 c.partial_ms = 0;
+    else if (consumed || !c.partial_ms) c.partial_ms = c.active_ms;
+
+    if (eof) {
+        // a v1/v2 line without the trailing newline is still a request
+        if (c.framing == Framing::Line && !c.persistent && c.inflight == 0 &&
+            !c.in.empty()) {
+            dispatch(id, c, Message{IPC_FORMAT_JSON, false, std::move(c.in)});
+            c.in.clear();
+        }
+        c.closing = true;
+        if (c.inflight == 0 && c.sent >= c.out.size()) { close_conn(id); return; }
+    }
+    update_events(id, c);
+}
+
+bool IPCServer::next_message(Conn& c, Message& m, const char*& err) {
+    if (c.framing == Framing::Line) {
+        size_t nl = c.in.find('\n');
+        if (nl == std::string::npos) {
+            if (c.in.size() > opts_.max_request) err = "request_too_large";
+            return false;
+        }
+        m.format  = IPC_FORMAT_JSON;
+        m.framed  = false;
+        m.payload = c.in.substr(0, nl);
+        c.in.erase(0, nl + 1);
+        return true;
+    }
+
+    IpcFrameHeader h;
+    if (c.in.size() < sizeof(h)) return false;
+    std::memcpy(&h, c.in.data(), sizeof(h));
+    if (h.magic[0] != IPC_FRAME_MAGIC0 || h.magic[1] != IPC_FRAME_MAGIC1 ||
+        (h.format != IPC_FORMAT_JSON && h.format != IPC_FORMAT_CBOR)) {
+        err = "bad_frame";
+        return false;
+    }
+    if (h.length > opts_.max_request) {
+        err = "request_too_large";
+        return false;
+    }
+    if (c.in.size() < sizeof(h) + h.length) return false;
+    m.format  = h.format;
+    m.framed  = true;
+    m.payload = c.in.substr(sizeof(h), h.length);
+    c.in.erase(0, sizeof(h) + h.length);
+    return true;
+}
+
+// c.in starts with a whole request, one held back by the pipelining limit
+bool IPCServer::has_message(const Conn& c) const {
+    if (c.framing == Framing::Line) return c.in.find('\n') != std::string::npos;
+    IpcFrameHeader h;
+    if (c.in.size() < sizeof(h)) return false;
+    std::memcpy(&h, c.in.data(), sizeof(h));
+    return c.in.size() >= sizeof(h) + h.length;
+}
+
+void IPCServer::dispatch(uint64_t id, Conn& c, Message m) {
+    ++c.inflight;
+    c.format = m.format;
+    auto msg = std::make_shared<Message>(std::move(m));
+    bool queued = pool_->submit([this, id, msg, cancel = c.cancel, peer = c.peer] {
+        post(id, handle(id, *msg, *cancel, peer, nullptr));
+    });
+    if (!queued) {
+        // answered right here, with the request's id so v3 clients can match it
+        post(id, handle(id, *msg, *c.cancel, c.peer, "busy"));
+    }
+}
 
-            close(client);
-            _exit(0);
+// Hand a reply or event from a worker to the event loop
+void IPCServer::post(uint64_t id, Reply r) {
+    {
+        std::lock_guard<std::mutex> lk(done_mtx_);
+        done_.emplace_back(id, std::move(r));
+    }
+    uint64_t one = 1;
+    (void)!write(wake_fd_, &one, sizeof(one));
+}
+
+// Error raised by the loop itself; `close_after` for errors that leave
+// the stream unframed (oversized or malformed input, timeouts)
+void IPCServer::fail(uint64_t id, Conn& c, const char* err, const char* hint,
+                     bool close_after) {
+    json resp = {{"v", c.persistent || c.framing == Framing::Binary ? IPC_VERSION : 2},
+                 {"ok",false},{"err",err},{"id",nullptr}};
+    if (hint) resp["hint"] = hint;
+    c.out += encode(resp, c.framing == Framing::Binary ? c.format : (uint8_t)IPC_FORMAT_JSON,
+                    c.framing == Framing::Binary);
+    if (close_after) {
+        c.closing = true;
+        c.in.clear();
+    }
+    flush(id, c);
+}
+
+void IPCServer::collect_done() {
+    std::vector<std::pair<uint64_t, Reply>> done;
+    {
+        std::lock_guard<std::mutex> lk(done_mtx_);
+        done.swap(done_);
+    }
+    for (auto& d : done) {
+        auto it = conns_.find(d.first);
+        if (it == conns_.end()) continue;
+        Conn& c = it->second;
+        if (d.second.final) --c.inflight;
+        if (d.second.v3) c.persistent = true;
+        if (!c.persistent) c.closing = true;   // v1/v2: one answer per connection
+        c.out      += d.second.bytes;
+        c.active_ms = now_ms();
+        if (!flush(d.first, c)) continue;
+        // requests held back by the pipelining limit
+        if (!c.closing && !c.in.empty()) on_readable(d.first, c);
+    }
+}
+
+// Send what is queued; false if the connection was closed
+bool IPCServer::flush(uint64_t id, Conn& c) {
+    while (c.sent < c.out.size()) {
+        ssize_t w = send(c.fd, c.out.data() + c.sent, c.out.size() - c.sent,
+                         MSG_NOSIGNAL);
+        if (w > 0) {
+            c.sent     += (size_t)w;
+            c.active_ms = now_ms();
+            continue;
         }
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            update_events(id, c);
+            return true;
+        }
+        close_conn(id);   // peer gone
+        return false;
+    }
+    c.out.clear();
+    c.sent = 0;
+    if (c.closing && c.inflight == 0) {
+        close_conn(id);
+        return false;
+    }
+    update_events(id, c);
+    return true;
+}
+
+void IPCServer::update_events(uint64_t id, Conn& c) {
+    uint32_t want = 0;
+    if (!c.closing && (size_t)c.inflight < opts_.max_inflight)
+        want |= EPOLLIN | EPOLLRDHUP;
+    if (c.sent < c.out.size())
+        want |= EPOLLOUT;
+    if (want == c.events) return;
+
+    epoll_event ev{};
+    ev.events   = want;
+    ev.data.u64 = id;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, c.fd, &ev) == 0)
+        c.events = want;
+}
 
-        close(client);
+// When the connection times out, or -1 while it waits on a handler
+int64_t IPCServer::deadline(const Conn& c) const {
+    if (c.sent < c.out.size()) return c.active_ms + opts_.read_timeout_ms;   // stalled write
+    if (!c.in.empty()) {
+        // a whole request waiting for a pipelining slot is not slow: it
+        // waits as long as the requests in flight take
+        if ((size_t)c.inflight >= opts_.max_inflight && has_message(c)) return -1;
+        return c.partial_ms + opts_.read_timeout_ms;   // slow request
+    }
+    if (c.inflight > 0)        return -1;
+    return c.active_ms + (c.persistent ? opts_.idle_timeout_ms : opts_.read_timeout_ms);
+}
+
+void IPCServer::expire(int64_t now) {
+    std::vector<uint64_t> late;
+    for (const auto& kv : conns_) {
+        int64_t d = deadline(kv.second);
+        if (d >= 0 && d <= now) late.push_back(kv.first);
+    }
+
+    for (uint64_t id : late) {
+        Conn& c = conns_.at(id);
+        if (c.sent >= c.out.size() && !c.in.empty() && !c.closing) {
+            spdlog::debug("IPC: request not complete within {} ms", opts_.read_timeout_ms);
+            fail(id, c, "timeout", nullptr, true);
+        } else {
+            close_conn(id);
+        }
     }
-}
\ No newline at end of file
+}
+
+void IPCServer::close_conn(uint64_t id) {
+    auto it = conns_.find(id);
+    if (it == conns_.end()) return;
+    if (it->second.inflight > 0) {
+        spdlog::debug("IPC: client left with {} request(s) in flight",
+                      it->second.inflight);
+        it->second.cancel->cancel();
+    }
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, it->second.fd, nullptr);
+    close(it->second.fd);
+    conns_.erase(it);
+}
+
+// ------------------------------------------------------------
+//  Request handling (worker threads)
+// ------------------------------------------------------------
+IPCServer::Reply IPCServer::handle(uint64_t conn, const Message& m,
+                                   const CancelToken& cancel, const PeerCred& peer,
+                                   const char* reject) {
+    json resp;
+    json id = nullptr;
+    bool v3 = m.framed;
+    try {
+        json req = m.format == IPC_FORMAT_CBOR
+                 ? json::from_cbor(m.payload.begin(), m.payload.end())
+                 : json::parse(m.payload);
+
+        // v1 clients (no "v" field) and v2 clients are still accepted;
+        // binary frames are v3 by definition
+        int ver = req.value("v", m.framed ? IPC_VERSION : 1);
+        if (ver == IPC_VERSION) {
+            v3 = true;
+            if (req.contains("id")) id = req["id"];
+        }
+        if (ver > IPC_VERSION) {
+            resp = {{"v",2},{"ok",false},{"err","unsupported_version"}};
+        } else if (reject) {
+            resp = {{"v",2},{"ok",false},{"err",reject},
+                    {"hint","Too many requests in flight, retry shortly"}};
+        } else {
+            Emit emit = [](const json&) {};
+            if (v3) {
+                emit = [this, conn, &m, &id](const json& event) {
+                    json e = event;
+                    e["v"]  = IPC_VERSION;
+                    e["id"] = id;
+                    post(conn, {encode(e, m.format, m.framed), true, false});
+                };
+            }
+            resp = handler_(req, emit, cancel, peer);
+        }
+    } catch (const std::exception& e) {
+        resp = {{"v",2},{"ok",false},{"err",
+            std::string("parse_error: ") + e.what()}};
+    }
+    if (v3) {
+        resp["v"]  = IPC_VERSION;
+        resp["id"] = id;
+    }
+    return {encode(resp, m.format, m.framed), v3};
+}
@@ -1,4 +1,6 @@
 #include "facelock/onnx_wrapper.h"
+#include "facelock/preprocess.h"
+#include "facelock/trace.h"
 
 #ifdef FACELOCK_ENABLE_ONNX
 
@@ -10,30 +12,222 @@
 #else
 #  error "Cannot find onnxruntime_cxx_api.h — check your ONNX Runtime installation"
 #endif
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <stdexcept>
 #include <vector>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
 #include <iostream>
+#include <filesystem>
+#include <spdlog/spdlog.h>
 
 using namespace facelock;
 
 // ===================== REAL IMPLEMENTATION =====================
 
+// One Ort::Env per process, as ORT recommends; every session uses it
+static Ort::Env& shared_env() {
+    static Ort::Env env(ORT_LOGGING_LEVEL_WARNING, "facelock");
+    return env;
+}
+
+// Read-only mapping of a model file. Sessions built from an ORT-format
+// graph reference these bytes directly, so the mapping must outlive them.
+struct MappedFile {
+    const void* data = nullptr;
+    size_t      size = 0;
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { if (data) munmap(const_cast<void*>(data), size); }
+
+    static std::shared_ptr<MappedFile> open(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return nullptr;
+        struct stat st;
+        void *addr = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+            addr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) return nullptr;
+
+        auto f = std::make_shared<MappedFile>();
+        f->data = addr;
+        f->size = (size_t)st.st_size;
+        return f;
+    }
+};
+
+// FNV-1a over 8-byte words: a cache key, not a checksum, and quick
+// enough to run over a 100+ MB model at every start
+static uint64_t hash_bytes(const MappedFile &f) {
+    const auto *p = static_cast<const unsigned char*>(f.data);
+    uint64_t h = 1469598103934665603ull ^ f.size;
+    size_t i = 0;
+    for (; i + 8 <= f.size; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, p + i, 8);
+        h = (h ^ w) * 1099511628211ull;
+    }
+    for (; i < f.size; ++i) h = (h ^ p[i]) * 1099511628211ull;
+    return h;
+}
+
+struct ONNXWrapper::Shared {
+    // sessions created with the same container keep a single copy of
+    // the prepacked (layout-transformed) weights
+    Ort::PrepackedWeightsContainer prepacked;
+
+    // model bytes every session is built from: the cached optimised
+    // ORT-format graph when there is one, else the mmap'd .onnx file.
+    // Resolved once, by whichever session is constructed first.
+    std::mutex                  mtx;
+    bool                        resolved   = false;
+    bool                        ort_format = false;
+    std::shared_ptr<MappedFile> model;
+    uint64_t                    hash = 0;   // of the .onnx bytes, 0 if unknown
+
+    void resolve(const std::string &model_path, const std::string &cache_dir);
+};
+
+// ------------------------------------------------------------
+//  Optimised graph cache
+//
+//  <cache_dir>/<model stem>-<model hash>-ort<ORT version>.ort holds
+//  the graph after ORT's extended (hardware-independent) passes, so a
+//  restart skips them. Hardware-specific layout passes still run at
+//  load. A new model file or ORT upgrade simply misses the cache.
+// ------------------------------------------------------------
+static std::string cache_file(const std::string &model_path,
+                              const std::string &cache_dir,
+                              uint64_t hash) {
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", (unsigned long long)hash);
+    std::string name = std::filesystem::path(model_path).stem().string() +
+                       "-" + key + "-ort" + Ort::GetVersionString() + ".ort";
+    return (std::filesystem::path(cache_dir) / name).string();
+}
+
+// Optimise the model once and write it out as an ORT-format graph.
+// Written to a temp name and renamed so a crash never leaves a
+// truncated cache entry behind.
+static bool export_optimized(const MappedFile &model, const std::string &dest) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    fs::create_directories(fs::path(dest).parent_path(), ec);
+
+    std::string tmp = dest + ".tmp" + std::to_string(getpid());
+    try {
+        Ort::SessionOptions so;
+        so.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_EXTENDED);
+        so.AddConfigEntry("session.save_model_format", "ORT");
+        so.SetOptimizedModelFilePath(tmp.c_str());
+        Ort::Session export_session(shared_env(), model.data, model.size, so);
+    } catch (const std::exception &e) {
+        spdlog::warn("Could not write optimised graph cache {}: {}", dest, e.what());
+        fs::remove(tmp, ec);
+        return false;
+    }
+    fs::rename(tmp, dest, ec);
+    if (ec) {
+        spdlog::warn("Could not write optimised graph cache {}: {}", dest, ec.message());
+        fs::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+void ONNXWrapper::Shared::resolve(const std::string &model_path,
+                                  const std::string &cache_dir) {
+    std::lock_guard<std::mutex> lk(mtx);
+    if (resolved) return;
+    resolved = true;
+
+    model = MappedFile::open(model_path);
+    if (!model) return;
+    hash = hash_bytes(*model);
+    if (cache_dir.empty()) return;
+
+    std::string cached = cache_file(model_path, cache_dir, hash);
+    auto graph = MappedFile::open(cached);
+    if (!graph && export_optimized(*model, cached)) {
+        spdlog::info("Saved optimised graph to {}", cached);
+        graph = MappedFile::open(cached);
+    }
+    if (graph) {
+        spdlog::info("Using optimised graph {}", cached);
+        model      = std::move(graph);
+        ort_format = true;
+    }
+}
+
+// Reusable preprocessing buffers. OpenCV reuses a destination that
+// already has the right size and type, so after the first call none of
+// these allocate.
+struct Scratch {
+    cv::Mat bgr, resized;
+};
+
 struct ONNXWrapper::Impl {
-    Ort::Env env;
     Ort::SessionOptions opts;
     std::unique_ptr<Ort::Session> session;
+    std::shared_ptr<ONNXWrapper::Shared> shared;
+    std::shared_ptr<MappedFile> model_bytes;   // kept alive for the session
     std::string model_path;
     std::string input_name;
     std::vector<std::string> output_names;
     std::pair<int,int> input_size = {112,112};
-
-    Impl(const std::string &model)
-        : env(ORT_LOGGING_LEVEL_WARNING, "facelock"), model_path(model)
+    int64_t batch_dim = 1;   // model's batch dimension; <= 0 means dynamic
+
+    // Preallocated single-face path: input/output tensors wrap these
+    // buffers and are bound once, so a steady-state embed_into() does
+    // no heap allocation.
+    std::vector<float>             in_buf;
+    std::vector<float>             out_buf;
+    Ort::Value                     in_tensor{nullptr};
+    Ort::Value                     out_tensor{nullptr};
+    std::unique_ptr<Ort::IoBinding> binding;
+    Ort::RunOptions                run_opts{nullptr};
+    Scratch                        scratch;
+
+    Impl(const std::string &model, const ONNXOptions &o,
+         std::shared_ptr<ONNXWrapper::Shared> sh)
+        : shared(std::move(sh)), model_path(model)
     {
-        opts.SetIntraOpNumThreads(1);
-
-        session = std::make_unique<Ort::Session>(env, model_path.c_str(), opts);
+        opts.SetIntraOpNumThreads(std::max(1, o.intra_op_threads));
+        opts.SetInterOpNumThreads(std::max(1, o.inter_op_threads));
+        if (o.inter_op_threads > 1)
+            opts.SetExecutionMode(ExecutionMode::ORT_PARALLEL);
+
+        if (!shared) shared = std::make_shared<ONNXWrapper::Shared>();
+        shared->resolve(model_path, o.cache_dir);
+        model_bytes = shared->model;
+
+        if (shared->ort_format) {
+            opts.AddConfigEntry("session.load_model_format", "ORT");
+            opts.AddConfigEntry("session.use_ort_model_bytes_directly", "1");
+        }
+        try {
+            if (model_bytes)
+                session = std::make_unique<Ort::Session>(
+                    shared_env(), model_bytes->data, model_bytes->size,
+                    opts, shared->prepacked);
+        } catch (const std::exception &e) {
+            if (shared->ort_format) throw;
+            // e.g. a model with external data, which needs its path
+            spdlog::warn("Loading {} from memory failed ({}), reading from disk",
+                         model_path, e.what());
+        }
+        if (!session)
+            session = std::make_unique<Ort::Session>(
+                shared_env(), model_path.c_str(), opts, shared->prepacked);
 
         // Input name
         try {
@@ -50,30 +244,96 @@ struct ONNXWrapper::Impl {
         try {
             auto info = session->GetInputTypeInfo(0).GetTensorTypeAndShapeInfo();
             auto shape = info.GetShape();
+            if (!shape.empty()) batch_dim = shape[0];
             if (shape.size() >= 4) {
                 int h = shape[2] > 0 ? shape[2] : 112;
                 int w = shape[3] > 0 ? shape[3] : 112;
                 input_size = {w, h};
             }
         } catch (...) {}
+
+        bind_buffers();
+    }
+
+    // Bind fixed 1x3xHxW input and 1xD output buffers. Models whose output
+    // size is not static keep using the allocating Run() path.
+    void bind_buffers() {
+        if (input_name.empty() || output_names.empty()) return;
+        try {
+            auto oshape = session->GetOutputTypeInfo(0)
+                              .GetTensorTypeAndShapeInfo().GetShape();
+            if (oshape.empty()) return;
+            oshape[0] = 1;                       // batch
+            size_t out_dim = 1;
+            for (auto d : oshape) {
+                if (d <= 0) return;              // dynamic feature dim
+                out_dim *= (size_t)d;
+            }
+
+            auto [W,H] = input_size;
+            std::vector<int64_t> ishape = {1, 3, H, W};
+            in_buf.assign(3 * (size_t)H * W, 0.f);
+            out_buf.assign(out_dim, 0.f);
+
+            Ort::MemoryInfo mem = Ort::MemoryInfo::CreateCpu(
+                OrtDeviceAllocator, OrtMemTypeCPU);
+            in_tensor = Ort::Value::CreateTensor<float>(
+                mem, in_buf.data(), in_buf.size(), ishape.data(), ishape.size());
+            out_tensor = Ort::Value::CreateTensor<float>(
+                mem, out_buf.data(), out_buf.size(), oshape.data(), oshape.size());
+
+            binding = std::make_unique<Ort::IoBinding>(*session);
+            binding->BindInput(input_name.c_str(), in_tensor);
+            binding->BindOutput(output_names[0].c_str(), out_tensor);
+        } catch (...) {
+            binding.reset();
+            out_buf.clear();
+        }
     }
 };
 
 // ---------- helpers ----------
-static void hwc_to_chw(const cv::Mat &src, std::vector<float> &out) {
-    int H = src.rows, W = src.cols;
-    out.resize(3 * H * W);
-    for (int c = 0; c < 3; ++c)
-        for (int y = 0; y < H; ++y)
-            for (int x = 0; x < W; ++x)
-                out[c * H * W + y * W + x] = src.at<cv::Vec3f>(y,x)[c];
+// BGR crop → normalised planar RGB at the model resolution. Helper crops
+// already come at 112x112, so the common path is a single fused pass.
+static void preprocess(const cv::Mat &bgr, int W, int H, float *out,
+                       Scratch &s) {
+    const cv::Mat *src = &bgr;
+    if (src->channels() == 1) {
+        cv::cvtColor(*src, s.bgr, cv::COLOR_GRAY2BGR);
+        src = &s.bgr;
+    }
+    if (src->cols != W || src->rows != H) {
+        cv::resize(*src, s.resized, {W,H});
+        src = &s.resized;
+    }
+    bgr_to_planar_rgb(src->data, src->step, W, H, out);
 }
 
+static void l2_normalize(float *v, size_t n) {
+    float norm = 0.f;
+    for (size_t i = 0; i < n; ++i) norm += v[i]*v[i];
+    norm = std::sqrt(norm);
+    if (norm > 1e-6f)
+        for (size_t i = 0; i < n; ++i) v[i] /= norm;
+}
+
+// Largest batch we hand to a model with a dynamic batch dimension
+static constexpr size_t MAX_DYNAMIC_BATCH = 32;
+
 // ---------- public API ----------
 ONNXWrapper::ONNXWrapper(const std::string &model_path,
-                         const std::vector<std::string>&)
+                         const std::vector<std::string>&,
+                         const ONNXOptions &opts)
 {
-    pimpl_ = new Impl(model_path);
+    pimpl_ = new Impl(model_path, opts, nullptr);
+    input_size_ = pimpl_->input_size;
+}
+
+ONNXWrapper::ONNXWrapper(const std::string &model_path,
+                         const ONNXOptions &opts,
+                         const std::shared_ptr<Shared> &shared)
+{
+    pimpl_ = new Impl(model_path, opts, shared);
     input_size_ = pimpl_->input_size;
 }
 
@@ -81,16 +341,47 @@ ONNXWrapper::~ONNXWrapper() {
     delete pimpl_;
 }
 
+size_t ONNXWrapper::embedding_dim() const {
+    return pimpl_->out_buf.size();
+}
+
+uint64_t ONNXWrapper::model_hash() const {
+    return pimpl_->shared ? pimpl_->shared->hash : 0;
+}
+
+bool ONNXWrapper::embed_into(const cv::Mat &bgr, float *out, size_t out_len) {
+    auto &p = *pimpl_;
+    if (!p.binding || out_len < p.out_buf.size()) return false;
+    auto [W,H] = p.input_size;
+
+    {
+        TraceSpan span("onnx.preprocess");
+        preprocess(bgr, W, H, p.in_buf.data(), p.scratch);
+    }
+    {
+        TraceSpan span("onnx.run");
+        p.session->Run(p.run_opts, *p.binding);
+    }
+
+    std::copy(p.out_buf.begin(), p.out_buf.end(), out);
+    l2_normalize(out, p.out_buf.size());
+    return true;
+}
+
 std::vector<float> ONNXWrapper::embed(const cv::Mat &bgr) {
-    auto [W,H] = pimpl_->input_size;
+    if (pimpl_->binding) {
+        std::vector<float> emb(pimpl_->out_buf.size());
+        embed_into(bgr, emb.data(), emb.size());
+        return emb;
+    }
 
-    cv::Mat rgb, resized;
-    cv::cvtColor(bgr, rgb, bgr.channels()==1 ? cv::COLOR_GRAY2RGB : cv::COLOR_BGR2RGB);
-    cv::resize(rgb, resized, {W,H});
-    resized.convertTo(resized, CV_32FC3, 1.0/255.0);
+    auto [W,H] = pimpl_->input_size;
 
-    std::vector<float> input;
-    hwc_to_chw(resized, input);
+    std::vector<float> input(3 * H * W);
+    {
+        TraceSpan span("onnx.preprocess");
+        preprocess(bgr, W, H, input.data(), pimpl_->scratch);
+    }
 
     Ort::MemoryInfo mem = Ort::MemoryInfo::CreateCpu(
         OrtDeviceAllocator, OrtMemTypeCPU);
@@ -103,6 +394,7 @@ std::vector<float> ONNXWrapper::embed(const cv::Mat &bgr) {
     std::vector<const char*> out_names;
     for (auto &s : pimpl_->output_names) out_names.push_back(s.c_str());
 
+    TraceSpan span("onnx.run");
     auto outputs = pimpl_->session->Run(
         Ort::RunOptions{nullptr},
         &in_name, &tensor, 1,
@@ -112,15 +404,64 @@ std::vector<float> ONNXWrapper::embed(const cv::Mat &bgr) {
     size_t n = outputs[0].GetTensorTypeAndShapeInfo().GetElementCount();
 
     std::vector<float> emb(ptr, ptr+n);
+    l2_normalize(emb.data(), emb.size());
+    return emb;
+}
 
-    // L2 normalize
-    float norm = 0.f;
-    for (float v : emb) norm += v*v;
-    norm = std::sqrt(norm);
-    if (norm > 1e-6f)
-        for (auto &v : emb) v /= norm;
+cv::Mat ONNXWrapper::embed_batch(const std::vector<cv::Mat> &bgr_crops) {
+    if (bgr_crops.empty()) return {};
+    auto [W,H] = pimpl_->input_size;
+    const size_t plane = 3 * (size_t)H * W;
 
-    return emb;
+    // dynamic batch dim → one Run per MAX_DYNAMIC_BATCH faces;
+    // fixed batch dim (usually 1) → chunks of exactly that size
+    const bool   dynamic = pimpl_->batch_dim <= 0;
+    const size_t chunk   = dynamic ? MAX_DYNAMIC_BATCH : (size_t)pimpl_->batch_dim;
+
+    Ort::MemoryInfo mem = Ort::MemoryInfo::CreateCpu(
+        OrtDeviceAllocator, OrtMemTypeCPU);
+    const char* in_name = pimpl_->input_name.c_str();
+    std::vector<const char*> out_names;
+    for (auto &s : pimpl_->output_names) out_names.push_back(s.c_str());
+
+    const size_t N = bgr_crops.size();
+    cv::Mat result;
+    std::vector<float> input;
+    Scratch scratch;
+
+    for (size_t start = 0; start < N; start += chunk) {
+        size_t n     = std::min(chunk, N - start);
+        size_t batch = dynamic ? n : chunk;   // fixed models need full batches
+
+        input.assign(batch * plane, 0.f);
+        {
+            TraceSpan span("onnx.preprocess");
+            for (size_t i = 0; i < n; ++i)
+                preprocess(bgr_crops[start + i], W, H, input.data() + i * plane, scratch);
+        }
+
+        std::vector<int64_t> shape = {(int64_t)batch, 3, H, W};
+        Ort::Value tensor = Ort::Value::CreateTensor<float>(
+            mem, input.data(), input.size(), shape.data(), shape.size());
+
+        TraceSpan span("onnx.run");
+        auto outputs = pimpl_->session->Run(
+            Ort::RunOptions{nullptr},
+            &in_name, &tensor, 1,
+            out_names.data(), out_names.size());
+
+        float* ptr   = outputs[0].GetTensorMutableData<float>();
+        size_t total = outputs[0].GetTensorTypeAndShapeInfo().GetElementCount();
+        size_t D     = total / batch;
+
+        if (result.empty()) result.create((int)N, (int)D, CV_32F);
+        for (size_t i = 0; i < n; ++i) {
+            float* row = result.ptr<float>((int)(start + i));
+            std::copy(ptr + i * D, ptr + (i + 1) * D, row);
+            l2_normalize(row, D);
+        }
+    }
+    return result;
 }
 
 std::vector<float> ONNXWrapper::run_raw(const cv::Mat &img) {
@@ -135,8 +476,17 @@ void ONNXWrapper::warmup(const cv::Mat &sample, int runs) {
 
 using namespace facelock;
 
+struct ONNXWrapper::Shared {};
+
 ONNXWrapper::ONNXWrapper(const std::string&,
-                         const std::vector<std::string>&)
+                         const std::vector<std::string>&,
+                         const ONNXOptions&)
+{
+    throw std::runtime_error("ONNX support disabled at build time");
+}
+
+ONNXWrapper::ONNXWrapper(const std::string&, const ONNXOptions&,
+                         const std::shared_ptr<Shared>&)
 {
     throw std::runtime_error("ONNX support disabled at build time");
 }
@@ -147,6 +497,18 @@ std::vector<float> ONNXWrapper::embed(const cv::Mat&) {
     throw std::runtime_error("ONNX support disabled");
 }
 
+cv::Mat ONNXWrapper::embed_batch(const std::vector<cv::Mat>&) {
+    throw std::runtime_error("ONNX support disabled");
+}
+
+bool ONNXWrapper::embed_into(const cv::Mat&, float*, size_t) {
+    throw std::runtime_error("ONNX support disabled");
+}
+
+size_t ONNXWrapper::embedding_dim() const { return 0; }
+
+uint64_t ONNXWrapper::model_hash() const { return 0; }
+
 std::vector<float> ONNXWrapper::run_raw(const cv::Mat&) {
     throw std::runtime_error("ONNX support disabled");
 }
@@ -154,3 +516,54 @@ std::vector<float> ONNXWrapper::run_raw(const cv::Mat&) {
 void ONNXWrapper::warmup(const cv::Mat&, int) {}
 
 #endif
+
+// ===================== SESSION POOL =====================
+
+ONNXSessionPool::ONNXSessionPool(const std::string &model_path, size_t size,
+                                 const ONNXOptions &opts)
+{
+    size = std::max<size_t>(1, size);
+    auto shared = std::make_shared<ONNXWrapper::Shared>();
+    busy_ = std::make_unique<std::atomic<bool>[]>(size);
+    for (size_t i = 0; i < size; ++i) {
+        busy_[i] = false;
+        sessions_.emplace_back(new ONNXWrapper(model_path, opts, shared));
+    }
+}
+
+ONNXSessionPool::~ONNXSessionPool() = default;
+
+bool ONNXSessionPool::try_acquire(size_t &idx) {
+    for (size_t i = 0; i < sessions_.size(); ++i) {
+        bool expected = false;
+        if (busy_[i].compare_exchange_strong(expected, true,
+                                             std::memory_order_acquire)) {
+            idx = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+ONNXSessionPool::Lease ONNXSessionPool::acquire() {
+    size_t idx = 0;
+    if (try_acquire(idx)) return Lease(this, idx);
+
+    // every session busy: wait for one to come back
+    TraceSpan span("onnx.acquire");
+    std::unique_lock<std::mutex> lk(wait_mtx_);
+    wait_cv_.wait(lk, [&] { return try_acquire(idx); });
+    return Lease(this, idx);
+}
+
+void ONNXSessionPool::release(size_t idx) {
+    busy_[idx].store(false, std::memory_order_release);
+    // take the lock so a waiter cannot miss the wakeup between its
+    // failed scan and going to sleep
+    { std::lock_guard<std::mutex> lk(wait_mtx_); }
+    wait_cv_.notify_one();
+}
+
+void ONNXSessionPool::warmup(const cv::Mat &sample, int runs) {
+    for (auto &s : sessions_) s->warmup(sample, runs);
+}
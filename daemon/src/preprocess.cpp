@@ -0,0 +1,181 @@
+#include "facelock/preprocess.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#  define FACELOCK_X86 1
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define FACELOCK_NEON 1
+#endif
+
+using namespace facelock;
+
+static constexpr float INV_255 = 1.0f / 255.0f;
+
+// Pixels [x, width) of one row, scalar
+static inline void row_scalar(const uint8_t* src, int x, int width,
+                              float* r, float* g, float* b) {
+    for (; x < width; ++x) {
+        b[x] = src[3*x + 0] * INV_255;
+        g[x] = src[3*x + 1] * INV_255;
+        r[x] = src[3*x + 2] * INV_255;
+    }
+}
+
+void facelock::bgr_to_planar_rgb_scalar(const uint8_t* bgr, size_t stride,
+                                        int width, int height, float* out) {
+    const size_t plane = (size_t)width * height;
+    for (int y = 0; y < height; ++y) {
+        size_t off = (size_t)y * width;
+        row_scalar(bgr + (size_t)y * stride, 0, width,
+                   out + off, out + plane + off, out + 2 * plane + off);
+    }
+}
+
+#ifdef FACELOCK_X86
+// ------------------------------------------------------------
+//  SSE4.1: 4 pixels per step. One unaligned 16-byte load covers
+//  12 bytes of pixel data; pshufb gathers each channel into the
+//  low 4 bytes, which are widened to int32 and converted.
+// ------------------------------------------------------------
+__attribute__((target("sse4.1")))
+static void kernel_sse41(const uint8_t* bgr, size_t stride,
+                         int width, int height, float* out) {
+    const __m128i shuf_b = _mm_setr_epi8(0, 3, 6, 9, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+    const __m128i shuf_g = _mm_setr_epi8(1, 4, 7, 10,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+    const __m128i shuf_r = _mm_setr_epi8(2, 5, 8, 11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+    const __m128  scale  = _mm_set1_ps(INV_255);
+    const size_t  plane  = (size_t)width * height;
+
+    for (int y = 0; y < height; ++y) {
+        const uint8_t* src = bgr + (size_t)y * stride;
+        size_t off = (size_t)y * width;
+        float* r = out + off;
+        float* g = out + plane + off;
+        float* b = out + 2 * plane + off;
+
+        int x = 0;
+        // the 16-byte load reads 4 bytes past the 4 pixels consumed
+        for (; x + 6 <= width; x += 4) {
+            __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3*x));
+            __m128 vb = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_shuffle_epi8(px, shuf_b)));
+            __m128 vg = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_shuffle_epi8(px, shuf_g)));
+            __m128 vr = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_shuffle_epi8(px, shuf_r)));
+            _mm_storeu_ps(b + x, _mm_mul_ps(vb, scale));
+            _mm_storeu_ps(g + x, _mm_mul_ps(vg, scale));
+            _mm_storeu_ps(r + x, _mm_mul_ps(vr, scale));
+        }
+        row_scalar(src, x, width, r, g, b);
+    }
+}
+
+// ------------------------------------------------------------
+//  AVX2: 8 pixels per step. Two overlapping 16-byte loads give
+//  pixels 0-3 and 4-7; per channel the two 4-byte gathers are
+//  joined and widened straight to 8 x int32.
+// ------------------------------------------------------------
+__attribute__((target("avx2")))
+static void kernel_avx2(const uint8_t* bgr, size_t stride,
+                        int width, int height, float* out) {
+    const __m128i shuf_b = _mm_setr_epi8(0, 3, 6, 9, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+    const __m128i shuf_g = _mm_setr_epi8(1, 4, 7, 10,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+    const __m128i shuf_r = _mm_setr_epi8(2, 5, 8, 11,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+    const __m256  scale  = _mm256_set1_ps(INV_255);
+    const size_t  plane  = (size_t)width * height;
+
+    for (int y = 0; y < height; ++y) {
+        const uint8_t* src = bgr + (size_t)y * stride;
+        size_t off = (size_t)y * width;
+        float* r = out + off;
+        float* g = out + plane + off;
+        float* b = out + 2 * plane + off;
+
+        int x = 0;
+        // the second load reads 4 bytes past the 8 pixels consumed
+        for (; x + 10 <= width; x += 8) {
+            const uint8_t* p = src + 3*x;
+            __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 12));
+
+            __m128i cb = _mm_unpacklo_epi32(_mm_shuffle_epi8(lo, shuf_b), _mm_shuffle_epi8(hi, shuf_b));
+            __m128i cg = _mm_unpacklo_epi32(_mm_shuffle_epi8(lo, shuf_g), _mm_shuffle_epi8(hi, shuf_g));
+            __m128i cr = _mm_unpacklo_epi32(_mm_shuffle_epi8(lo, shuf_r), _mm_shuffle_epi8(hi, shuf_r));
+
+            _mm256_storeu_ps(b + x, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(cb)), scale));
+            _mm256_storeu_ps(g + x, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(cg)), scale));
+            _mm256_storeu_ps(r + x, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(cr)), scale));
+        }
+        row_scalar(src, x, width, r, g, b);
+    }
+}
+#endif // FACELOCK_X86
+
+#ifdef FACELOCK_NEON
+// ------------------------------------------------------------
+//  NEON: vld3 deinterleaves 8 BGR pixels in one instruction
+// ------------------------------------------------------------
+static inline void store_u8x8(uint8x8_t v, float32x4_t scale, float* dst) {
+    uint16x8_t w = vmovl_u8(v);
+    vst1q_f32(dst,     vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(w))),  scale));
+    vst1q_f32(dst + 4, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(w))), scale));
+}
+
+static void kernel_neon(const uint8_t* bgr, size_t stride,
+                        int width, int height, float* out) {
+    const float32x4_t scale = vdupq_n_f32(INV_255);
+    const size_t      plane = (size_t)width * height;
+
+    for (int y = 0; y < height; ++y) {
+        const uint8_t* src = bgr + (size_t)y * stride;
+        size_t off = (size_t)y * width;
+        float* r = out + off;
+        float* g = out + plane + off;
+        float* b = out + 2 * plane + off;
+
+        int x = 0;
+        for (; x + 8 <= width; x += 8) {
+            uint8x8x3_t px = vld3_u8(src + 3*x);
+            store_u8x8(px.val[0], scale, b + x);
+            store_u8x8(px.val[1], scale, g + x);
+            store_u8x8(px.val[2], scale, r + x);
+        }
+        row_scalar(src, x, width, r, g, b);
+    }
+}
+#endif // FACELOCK_NEON
+
+// ------------------------------------------------------------
+//  Runtime dispatch
+// ------------------------------------------------------------
+using Kernel = void (*)(const uint8_t*, size_t, int, int, float*);
+
+struct Dispatch {
+    Kernel      fn;
+    const char* name;
+};
+
+static Dispatch select_kernel() {
+#ifdef FACELOCK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))   return {kernel_avx2,  "avx2"};
+    if (__builtin_cpu_supports("sse4.1")) return {kernel_sse41, "sse4.1"};
+#endif
+#ifdef FACELOCK_NEON
+    return {kernel_neon, "neon"};
+#endif
+    return {bgr_to_planar_rgb_scalar, "scalar"};
+}
+
+static const Dispatch& dispatch() {
+    static const Dispatch d = select_kernel();
+    return d;
+}
+
+void facelock::bgr_to_planar_rgb(const uint8_t* bgr, size_t stride,
+                                 int width, int height, float* out) {
+    dispatch().fn(bgr, stride, width, height, out);
+}
+
+const char* facelock::preprocess_kernel_name() {
+    return dispatch().name;
+}
@@ -0,0 +1,489 @@
+#include "facelock/similarity.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#  define FACELOCK_X86 1
+#elif defined(__aarch64__)
+#  include <arm_neon.h>
+#  define FACELOCK_NEON 1
+#endif
+
+using namespace facelock;
+
+// ArcFace-family models (w600k_mbf, r50, r100) all emit 512 floats
+static constexpr size_t COMMON_DIM = 512;
+
+static inline float dot_scalar(const float* a, const float* b, size_t n) {
+    // four partial sums break the serial add chain
+    float s0 = 0.f, s1 = 0.f, s2 = 0.f, s3 = 0.f;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += a[i]     * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; ++i) s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+void facelock::dot_rows_scalar(const float* q, const float* rows,
+                               size_t n, size_t dim, float* out) {
+    for (size_t r = 0; r < n; ++r)
+        out[r] = dot_scalar(q, rows + r * dim, dim);
+}
+
+// ------------------------------------------------------------
+//  Half-float conversion and int8 quantisation (scalar; the
+//  conversion side only runs at enroll time)
+// ------------------------------------------------------------
+uint16_t facelock::float_to_half(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, 4);
+    uint32_t sign = (x >> 16) & 0x8000u;
+    uint32_t mant = x & 0x007FFFFFu;
+    int      exp  = (int)((x >> 23) & 0xFF) - 127 + 15;
+
+    if (((x >> 23) & 0xFF) == 0xFF)                       // inf / nan
+        return (uint16_t)(sign | 0x7C00u | (mant ? 0x200u : 0));
+    if (exp >= 31) return (uint16_t)(sign | 0x7C00u);      // overflow → inf
+    if (exp <= 0) {                                        // subnormal / zero
+        if (exp < -10) return (uint16_t)sign;
+        mant |= 0x00800000u;
+        uint32_t shift = (uint32_t)(14 - exp);
+        uint32_t half  = mant >> shift;
+        uint32_t rem   = mant & ((1u << shift) - 1);
+        uint32_t mid   = 1u << (shift - 1);
+        if (rem > mid || (rem == mid && (half & 1))) ++half;
+        return (uint16_t)(sign | half);
+    }
+    uint32_t half = sign | ((uint32_t)exp << 10) | (mant >> 13);
+    uint32_t rem  = mant & 0x1FFFu;
+    if (rem > 0x1000u || (rem == 0x1000u && (half & 1))) ++half;   // round to even
+    return (uint16_t)half;
+}
+
+float facelock::half_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000u) << 16;
+    uint32_t exp  = (h >> 10) & 0x1F;
+    uint32_t mant = h & 0x3FFu;
+    uint32_t x;
+    if (exp == 0x1F) {
+        x = sign | 0x7F800000u | (mant << 13);
+    } else if (exp == 0) {
+        if (mant == 0) {
+            x = sign;
+        } else {                                           // renormalise
+            int e = -1;
+            do { mant <<= 1; ++e; } while (!(mant & 0x400u));
+            x = sign | ((uint32_t)(127 - 15 - e) << 23) | ((mant & 0x3FFu) << 13);
+        }
+    } else {
+        x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    }
+    float f;
+    std::memcpy(&f, &x, 4);
+    return f;
+}
+
+float facelock::quantize_i8(const float* v, size_t dim, int8_t* out) {
+    float maxabs = 0.f;
+    for (size_t i = 0; i < dim; ++i) maxabs = std::max(maxabs, std::fabs(v[i]));
+    if (maxabs <= 0.f) {
+        std::fill(out, out + dim, (int8_t)0);
+        return 0.f;
+    }
+    // +-127 only: keeps |a| * |b| * 2 inside int16 for maddubs
+    float inv = 127.f / maxabs;
+    for (size_t i = 0; i < dim; ++i)
+        out[i] = (int8_t)std::lrintf(std::min(127.f, std::max(-127.f, v[i] * inv)));
+    return maxabs / 127.f;
+}
+
+static void rows_f16_scalar(const float* q, const uint16_t* rows,
+                            size_t n, size_t dim, float* out) {
+    for (size_t r = 0; r < n; ++r) {
+        const uint16_t* e = rows + r * dim;
+        float s = 0.f;
+        for (size_t i = 0; i < dim; ++i) s += q[i] * half_to_float(e[i]);
+        out[r] = s;
+    }
+}
+
+static void rows_i8_scalar(const int8_t* q, float qscale, const int8_t* rows,
+                           const float* scales, size_t n, size_t dim, float* out) {
+    for (size_t r = 0; r < n; ++r) {
+        const int8_t* e = rows + r * dim;
+        int32_t s = 0;
+        for (size_t i = 0; i < dim; ++i) s += (int32_t)q[i] * e[i];
+        out[r] = (float)s * qscale * scales[r];
+    }
+}
+
+// Each kernel is a template on the dimension: D = 0 takes the runtime
+// `dim`, D = COMMON_DIM lets the compiler fully unroll the main loop.
+#ifdef FACELOCK_X86
+// ------------------------------------------------------------
+//  AVX2 + FMA: 4 x 8 lanes in flight per row
+// ------------------------------------------------------------
+__attribute__((target("avx2,fma")))
+static inline float hsum256(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 0x55));
+    return _mm_cvtss_f32(s);
+}
+
+template <size_t D>
+__attribute__((target("avx2,fma")))
+static void rows_avx2(const float* q, const float* rows,
+                      size_t n, size_t dim, float* out) {
+    const size_t len = D ? D : dim;
+    for (size_t r = 0; r < n; ++r) {
+        const float* e = rows + r * len;
+        __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps();
+        __m256 a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 32 <= len; i += 32) {
+            a0 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i),      _mm256_loadu_ps(e + i),      a0);
+            a1 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i + 8),  _mm256_loadu_ps(e + i + 8),  a1);
+            a2 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i + 16), _mm256_loadu_ps(e + i + 16), a2);
+            a3 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i + 24), _mm256_loadu_ps(e + i + 24), a3);
+        }
+        for (; i + 8 <= len; i += 8)
+            a0 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i), _mm256_loadu_ps(e + i), a0);
+        float s = hsum256(_mm256_add_ps(_mm256_add_ps(a0, a1), _mm256_add_ps(a2, a3)));
+        for (; i < len; ++i) s += q[i] * e[i];
+        out[r] = s;
+    }
+}
+
+// ------------------------------------------------------------
+//  AVX-512F: 4 x 16 lanes in flight per row
+// ------------------------------------------------------------
+__attribute__((target("avx512f")))
+static inline float hsum512(__m512 v) {
+    // maskz forms: the plain ones trip -Wmaybe-uninitialized in GCC 12 headers
+    const __mmask16 all = 0xFFFF;
+    v = _mm512_add_ps(v, _mm512_maskz_shuffle_f32x4(all, v, v, 0x4E));   // fold 256-bit halves
+    v = _mm512_add_ps(v, _mm512_maskz_shuffle_f32x4(all, v, v, 0xB1));   // fold 128-bit lanes
+    __m128 s = _mm512_maskz_extractf32x4_ps(0xF, v, 0);
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 0x55));
+    return _mm_cvtss_f32(s);
+}
+
+template <size_t D>
+__attribute__((target("avx512f")))
+static void rows_avx512(const float* q, const float* rows,
+                        size_t n, size_t dim, float* out) {
+    const size_t len = D ? D : dim;
+    for (size_t r = 0; r < n; ++r) {
+        const float* e = rows + r * len;
+        __m512 a0 = _mm512_setzero_ps(), a1 = _mm512_setzero_ps();
+        __m512 a2 = _mm512_setzero_ps(), a3 = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 64 <= len; i += 64) {
+            a0 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i),      _mm512_loadu_ps(e + i),      a0);
+            a1 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i + 16), _mm512_loadu_ps(e + i + 16), a1);
+            a2 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i + 32), _mm512_loadu_ps(e + i + 32), a2);
+            a3 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i + 48), _mm512_loadu_ps(e + i + 48), a3);
+        }
+        for (; i + 16 <= len; i += 16)
+            a0 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i), _mm512_loadu_ps(e + i), a0);
+        if (i < len) {
+            // masked tail: no scalar loop
+            __mmask16 m = (__mmask16)((1u << (len - i)) - 1);
+            a1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, q + i),
+                                 _mm512_maskz_loadu_ps(m, e + i), a1);
+        }
+        out[r] = hsum512(_mm512_add_ps(_mm512_add_ps(a0, a1), _mm512_add_ps(a2, a3)));
+    }
+}
+
+// ------------------------------------------------------------
+//  fp16 rows: F16C widens 8 halves per instruction
+// ------------------------------------------------------------
+__attribute__((target("avx2,fma,f16c")))
+static void rows_f16_avx2(const float* q, const uint16_t* rows,
+                          size_t n, size_t dim, float* out) {
+    for (size_t r = 0; r < n; ++r) {
+        const uint16_t* e = rows + r * dim;
+        __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= dim; i += 16) {
+            __m256 e0 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(e + i)));
+            __m256 e1 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(e + i + 8)));
+            a0 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i),     e0, a0);
+            a1 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i + 8), e1, a1);
+        }
+        float s = hsum256(_mm256_add_ps(a0, a1));
+        for (; i < dim; ++i) s += q[i] * half_to_float(e[i]);
+        out[r] = s;
+    }
+}
+
+__attribute__((target("avx512f")))
+static void rows_f16_avx512(const float* q, const uint16_t* rows,
+                            size_t n, size_t dim, float* out) {
+    for (size_t r = 0; r < n; ++r) {
+        const uint16_t* e = rows + r * dim;
+        const __mmask16 all = 0xFFFF;   // maskz: see hsum512
+        __m512 a0 = _mm512_setzero_ps(), a1 = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 32 <= dim; i += 32) {
+            __m512 e0 = _mm512_maskz_cvtph_ps(all, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(e + i)));
+            __m512 e1 = _mm512_maskz_cvtph_ps(all, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(e + i + 16)));
+            a0 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i),      e0, a0);
+            a1 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i + 16), e1, a1);
+        }
+        float s = hsum512(_mm512_add_ps(a0, a1));
+        for (; i < dim; ++i) s += q[i] * half_to_float(e[i]);
+        out[r] = s;
+    }
+}
+
+// ------------------------------------------------------------
+//  int8 rows. Both paths multiply |q| (unsigned) by r * sign(q)
+//  (signed), which is q * r, because the instructions take one
+//  unsigned and one signed operand.
+// ------------------------------------------------------------
+__attribute__((target("avx2")))
+static void rows_i8_avx2(const int8_t* q, float qscale, const int8_t* rows,
+                         const float* scales, size_t n, size_t dim, float* out) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    for (size_t r = 0; r < n; ++r) {
+        const int8_t* e = rows + r * dim;
+        __m256i acc = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 32 <= dim; i += 32) {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(q + i));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(e + i));
+            // |a|, |b| <= 127 so the pairwise int16 sums cannot saturate
+            __m256i p = _mm256_maddubs_epi16(_mm256_abs_epi8(a), _mm256_sign_epi8(b, a));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(p, ones));
+        }
+        __m128i s4 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        s4 = _mm_add_epi32(s4, _mm_shuffle_epi32(s4, 0x4E));
+        s4 = _mm_add_epi32(s4, _mm_shuffle_epi32(s4, 0xB1));
+        int32_t s = _mm_cvtsi128_si32(s4);
+        for (; i < dim; ++i) s += (int32_t)q[i] * e[i];
+        out[r] = (float)s * qscale * scales[r];
+    }
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static void rows_i8_vnni(const int8_t* q, float qscale, const int8_t* rows,
+                         const float* scales, size_t n, size_t dim, float* out) {
+    const __m512i zero = _mm512_setzero_si512();
+    for (size_t r = 0; r < n; ++r) {
+        const int8_t* e = rows + r * dim;
+        __m512i acc = _mm512_setzero_si512();
+        for (size_t i = 0; i < dim; i += 64) {
+            size_t   left = dim - i;
+            __mmask64 m   = left >= 64 ? ~(__mmask64)0 : (((__mmask64)1 << left) - 1);
+            __m512i  a    = _mm512_maskz_loadu_epi8(m, q + i);
+            __m512i  b    = _mm512_maskz_loadu_epi8(m, e + i);
+            __m512i  bs   = _mm512_mask_sub_epi8(b, _mm512_movepi8_mask(a), zero, b);
+            acc = _mm512_dpbusd_epi32(acc, _mm512_abs_epi8(a), bs);
+        }
+        // same fold as hsum512, on integer lanes
+        const __mmask16 all = 0xFFFF;
+        acc = _mm512_add_epi32(acc, _mm512_maskz_shuffle_i32x4(all, acc, acc, 0x4E));
+        acc = _mm512_add_epi32(acc, _mm512_maskz_shuffle_i32x4(all, acc, acc, 0xB1));
+        __m128i s4 = _mm512_maskz_extracti32x4_epi32(0xF, acc, 0);
+        s4 = _mm_add_epi32(s4, _mm_shuffle_epi32(s4, 0x4E));
+        s4 = _mm_add_epi32(s4, _mm_shuffle_epi32(s4, 0xB1));
+        out[r] = (float)_mm_cvtsi128_si32(s4) * qscale * scales[r];
+    }
+}
+#endif // FACELOCK_X86
+
+#ifdef FACELOCK_NEON
+// ------------------------------------------------------------
+//  NEON: 4 x 4 lanes in flight per row
+// ------------------------------------------------------------
+template <size_t D>
+static void rows_neon(const float* q, const float* rows,
+                      size_t n, size_t dim, float* out) {
+    const size_t len = D ? D : dim;
+    for (size_t r = 0; r < n; ++r) {
+        const float* e = rows + r * len;
+        float32x4_t a0 = vdupq_n_f32(0.f), a1 = vdupq_n_f32(0.f);
+        float32x4_t a2 = vdupq_n_f32(0.f), a3 = vdupq_n_f32(0.f);
+        size_t i = 0;
+        for (; i + 16 <= len; i += 16) {
+            a0 = vfmaq_f32(a0, vld1q_f32(q + i),      vld1q_f32(e + i));
+            a1 = vfmaq_f32(a1, vld1q_f32(q + i + 4),  vld1q_f32(e + i + 4));
+            a2 = vfmaq_f32(a2, vld1q_f32(q + i + 8),  vld1q_f32(e + i + 8));
+            a3 = vfmaq_f32(a3, vld1q_f32(q + i + 12), vld1q_f32(e + i + 12));
+        }
+        for (; i + 4 <= len; i += 4)
+            a0 = vfmaq_f32(a0, vld1q_f32(q + i), vld1q_f32(e + i));
+        float s = vaddvq_f32(vaddq_f32(vaddq_f32(a0, a1), vaddq_f32(a2, a3)));
+        for (; i < len; ++i) s += q[i] * e[i];
+        out[r] = s;
+    }
+}
+
+static void rows_f16_neon(const float* q, const uint16_t* rows,
+                          size_t n, size_t dim, float* out) {
+    for (size_t r = 0; r < n; ++r) {
+        const uint16_t* e = rows + r * dim;
+        float32x4_t a0 = vdupq_n_f32(0.f), a1 = vdupq_n_f32(0.f);
+        size_t i = 0;
+        for (; i + 8 <= dim; i += 8) {
+            float32x4_t e0 = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(e + i)));
+            float32x4_t e1 = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(e + i + 4)));
+            a0 = vfmaq_f32(a0, vld1q_f32(q + i),     e0);
+            a1 = vfmaq_f32(a1, vld1q_f32(q + i + 4), e1);
+        }
+        float s = vaddvq_f32(vaddq_f32(a0, a1));
+        for (; i < dim; ++i) s += q[i] * half_to_float(e[i]);
+        out[r] = s;
+    }
+}
+
+static void rows_i8_neon(const int8_t* q, float qscale, const int8_t* rows,
+                         const float* scales, size_t n, size_t dim, float* out) {
+    for (size_t r = 0; r < n; ++r) {
+        const int8_t* e = rows + r * dim;
+        int32x4_t acc = vdupq_n_s32(0);
+        size_t i = 0;
+        for (; i + 16 <= dim; i += 16) {
+            int8x16_t a = vld1q_s8(q + i), b = vld1q_s8(e + i);
+            acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(a),  vget_low_s8(b)));
+            acc = vpadalq_s16(acc, vmull_s8(vget_high_s8(a), vget_high_s8(b)));
+        }
+        int32_t s = vaddvq_s32(acc);
+        for (; i < dim; ++i) s += (int32_t)q[i] * e[i];
+        out[r] = (float)s * qscale * scales[r];
+    }
+}
+#endif // FACELOCK_NEON
+
+// ------------------------------------------------------------
+//  Runtime dispatch
+// ------------------------------------------------------------
+using Kernel    = void (*)(const float*, const float*, size_t, size_t, float*);
+using KernelF16 = void (*)(const float*, const uint16_t*, size_t, size_t, float*);
+using KernelI8  = void (*)(const int8_t*, float, const int8_t*, const float*,
+                           size_t, size_t, float*);
+
+struct Dispatch {
+    Kernel      any;      // runtime dim
+    Kernel      common;   // dim == COMMON_DIM
+    KernelF16   f16;
+    KernelI8    i8;
+    const char* name;
+};
+
+static Dispatch select_kernel() {
+#ifdef FACELOCK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni"))
+            return {rows_avx512<0>, rows_avx512<COMMON_DIM>, rows_f16_avx512,
+                    rows_i8_vnni, "avx512+vnni"};
+        return {rows_avx512<0>, rows_avx512<COMMON_DIM>, rows_f16_avx512,
+                rows_i8_avx2, "avx512"};
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+        __builtin_cpu_supports("f16c"))
+        return {rows_avx2<0>, rows_avx2<COMMON_DIM>, rows_f16_avx2,
+                rows_i8_avx2, "avx2"};
+#endif
+#ifdef FACELOCK_NEON
+    return {rows_neon<0>, rows_neon<COMMON_DIM>, rows_f16_neon, rows_i8_neon, "neon"};
+#endif
+    return {dot_rows_scalar, dot_rows_scalar, rows_f16_scalar, rows_i8_scalar, "scalar"};
+}
+
+static const Dispatch& dispatch() {
+    static const Dispatch d = select_kernel();
+    return d;
+}
+
+void facelock::dot_rows(const float* q, const float* rows,
+                        size_t n, size_t dim, float* out) {
+    const Dispatch& d = dispatch();
+    (dim == COMMON_DIM ? d.common : d.any)(q, rows, n, dim, out);
+}
+
+void facelock::dot_rows_f16(const float* q, const uint16_t* rows,
+                            size_t n, size_t dim, float* out) {
+    dispatch().f16(q, rows, n, dim, out);
+}
+
+void facelock::dot_rows_i8(const int8_t* q, float qscale, const int8_t* rows,
+                           const float* scales, size_t n, size_t dim, float* out) {
+    dispatch().i8(q, qscale, rows, scales, n, dim, out);
+}
+
+float facelock::dot(const float* a, const float* b, size_t dim) {
+    float s;
+    dot_rows(a, b, 1, dim, &s);
+    return s;
+}
+
+size_t facelock::top_k_distances(const float* q, const float* rows,
+                                 size_t n, size_t dim, size_t k, float* out) {
+    TemplateMatrix m;
+    m.rows = rows;
+    m.n    = n;
+    m.dim  = dim;
+    return top_k_distances(q, m, k, out);
+}
+
+// largest dim the int8 path quantises a query for on the stack
+static constexpr size_t MAX_I8_DIM = 4096;
+
+size_t facelock::top_k_distances(const float* q, const TemplateMatrix& m,
+                                 size_t k, float* out) {
+    k = std::min(k, m.n);
+    if (k == 0) return 0;
+    if (m.type == TEMPLATE_I8 && m.dim > MAX_I8_DIM) return 0;
+
+    int8_t q8[MAX_I8_DIM];
+    float  qscale = 0.f;
+    if (m.type == TEMPLATE_I8) qscale = quantize_i8(q, m.dim, q8);
+
+    // score a block at a time into a stack buffer, then keep the k best
+    // in out[] by insertion (k is 3 for auth, so this beats any heap)
+    constexpr size_t BLOCK = 64;
+    float  sims[BLOCK];
+    size_t kept = 0;
+
+    for (size_t start = 0; start < m.n; start += BLOCK) {
+        size_t cnt = std::min(BLOCK, m.n - start);
+        size_t off = start * m.dim;
+        switch (m.type) {
+        case TEMPLATE_F16:
+            dot_rows_f16(q, static_cast<const uint16_t*>(m.rows) + off, cnt, m.dim, sims);
+            break;
+        case TEMPLATE_I8:
+            dot_rows_i8(q8, qscale, static_cast<const int8_t*>(m.rows) + off,
+                        m.scales + start, cnt, m.dim, sims);
+            break;
+        default:
+            dot_rows(q, static_cast<const float*>(m.rows) + off, cnt, m.dim, sims);
+            break;
+        }
+        for (size_t i = 0; i < cnt; ++i) {
+            float d = 1.f - sims[i];
+            if (kept == k && d >= out[k - 1]) continue;
+            size_t j = kept < k ? kept++ : k - 1;
+            while (j > 0 && out[j - 1] > d) { out[j] = out[j - 1]; --j; }
+            out[j] = d;
+        }
+    }
+    return kept;
+}
+
+const char* facelock::similarity_kernel_name() {
+    return dispatch().name;
+}
@@ -1,32 +1,540 @@
 #include "facelock/storage.h"
-#include <fstream>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <vector>
 #include <filesystem>
+#include <zlib.h>
+#include <spdlog/spdlog.h>
 
 using namespace facelock;
 namespace fs = std::filesystem;
 
-bool facelock::save_embeddings(const std::string& data_dir, const std::string& user, const std::vector<std::vector<float>>& embs) {
+const char* const facelock::GALLERY_SUFFIX = ".gallery";
+const char* const facelock::ADAPT_SUFFIX   = ".adapt";
+
+static const char* LEGACY_SUFFIX = "_onnx_emb.bin";
+
+// Refuse absurd headers instead of trusting whatever a corrupt file says
+static constexpr uint32_t MAX_TEMPLATES = 1u << 20;
+static constexpr uint32_t MAX_DIM       = 4096;
+
+static uint32_t crc(const void* p, size_t n) {
+    uLong c = crc32(0L, Z_NULL, 0);
+    const auto* b = static_cast<const Bytef*>(p);
+    // zlib takes uInt lengths
+    while (n > 0) {
+        uInt chunk = (uInt)std::min<size_t>(n, 1u << 30);
+        c = crc32(c, b, chunk);
+        b += chunk;
+        n -= chunk;
+    }
+    return (uint32_t)c;
+}
+
+bool facelock::parse_gallery_dtype(const std::string& name, GalleryDType& out) {
+    if      (name == "f32") out = GALLERY_F32;
+    else if (name == "f16") out = GALLERY_F16;
+    else if (name == "i8")  out = GALLERY_I8;
+    else return false;
+    return true;
+}
+
+const char* facelock::gallery_dtype_name(GalleryDType t) {
+    switch (t) {
+    case GALLERY_F16: return "f16";
+    case GALLERY_I8:  return "i8";
+    default:          return "f32";
+    }
+}
+
+static size_t elem_size(uint16_t dtype) {
+    switch (dtype) {
+    case GALLERY_F32: return 4;
+    case GALLERY_F16: return 2;
+    case GALLERY_I8:  return 1;
+    default:          return 0;
+    }
+}
+
+static uint64_t align64(uint64_t v) { return (v + 63) & ~uint64_t(63); }
+
+// Data section of a gallery: the matrix, plus the scale block for int8
+static uint64_t data_size(uint16_t dtype, uint32_t n, uint32_t dim) {
+    uint64_t matrix = (uint64_t)n * dim * elem_size(dtype);
+    return dtype == GALLERY_I8 ? align64(matrix) + (uint64_t)n * sizeof(float)
+                               : matrix;
+}
+
+std::string facelock::gallery_path(const std::string& data_dir,
+                                   const std::string& user) {
+    return (fs::path(data_dir) / (user + GALLERY_SUFFIX)).string();
+}
+
+static bool strip_suffix(const std::string& name, const char* suffix,
+                         std::string& stem) {
+    const size_t sl = std::strlen(suffix);
+    if (name.size() <= sl || name[0] == '.' ||
+        name.compare(name.size() - sl, sl, suffix) != 0)
+        return false;
+    stem = name.substr(0, name.size() - sl);
+    return true;
+}
+
+std::vector<std::string> facelock::list_galleries(const std::string& data_dir) {
+    std::vector<std::string> users;
+    std::error_code ec;
+    for (const auto& e : fs::directory_iterator(data_dir, ec)) {
+        std::string user, name = e.path().filename().string();
+        if (strip_suffix(name, GALLERY_SUFFIX, user) ||
+            strip_suffix(name, LEGACY_SUFFIX, user))
+            users.push_back(std::move(user));
+    }
+    std::sort(users.begin(), users.end());
+    users.erase(std::unique(users.begin(), users.end()), users.end());
+    return users;
+}
+
+// ------------------------------------------------------------
+//  Writing
+// ------------------------------------------------------------
+static bool write_all(int fd, const void* buf, size_t n) {
+    const char* p = static_cast<const char*>(buf);
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w;
+        n -= (size_t)w;
+    }
+    return true;
+}
+
+bool facelock::save_gallery(const std::string& data_dir, const std::string& user,
+                            const float* rows, uint32_t n, uint32_t dim,
+                            uint64_t model_hash, GalleryDType dtype) {
+    if (!rows || n == 0 || dim == 0 || elem_size(dtype) == 0) return false;
+
+    // convert to the stored representation
+    const size_t count = (size_t)n * dim;
+    std::vector<uint8_t> data;
+    const void* payload = rows;
+    if (dtype == GALLERY_F16) {
+        data.resize(data_size(dtype, n, dim));
+        auto* h = reinterpret_cast<uint16_t*>(data.data());
+        for (size_t i = 0; i < count; ++i) h[i] = float_to_half(rows[i]);
+        payload = data.data();
+    } else if (dtype == GALLERY_I8) {
+        data.assign(data_size(dtype, n, dim), 0);
+        auto* q      = reinterpret_cast<int8_t*>(data.data());
+        auto* scales = reinterpret_cast<float*>(data.data() + align64(count));
+        for (uint32_t r = 0; r < n; ++r)
+            scales[r] = quantize_i8(rows + (size_t)r * dim, dim, q + (size_t)r * dim);
+        payload = data.data();
+    }
+
     fs::path dir(data_dir);
-    fs::create_directories(dir);
-    fs::path out = dir / (user + "_emb.bin");
-    std::ofstream ofs(out, std::ios::binary);
-    if(!ofs) return false;
-    uint32_t n = static_cast<uint32_t>(embs.size());
-    uint32_t d = embs.empty() ? 0 : static_cast<uint32_t>(embs[0].size());
-    ofs.write(reinterpret_cast<const char*>(&n), sizeof(n));
-    ofs.write(reinterpret_cast<const char*>(&d), sizeof(d));
-    for(const auto &v : embs) ofs.write(reinterpret_cast<const char*>(v.data()), sizeof(float)*d);
-    ofs.close();
-    return true;
-}
-
-std::vector<std::vector<float>> facelock::load_embeddings(const std::string& data_dir, const std::string& user) {
-    std::vector<std::vector<float>> out;
-    fs::path in = fs::path(data_dir) / (user + "_emb.bin");
-    if(!fs::exists(in)) return out;
-    std::ifstream ifs(in, std::ios::binary);
-    uint32_t n,d; ifs.read(reinterpret_cast<char*>(&n), sizeof(n)); ifs.read(reinterpret_cast<char*>(&d), sizeof(d));
-    out.resize(n, std::vector<float>(d));
-    for(uint32_t i=0;i<n;i++) ifs.read(reinterpret_cast<char*>(out[i].data()), sizeof(float)*d);
-    return out;
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+
+    GalleryHeader hdr;
+    std::memset(&hdr, 0, sizeof(hdr));
+    hdr.magic       = GALLERY_MAGIC;
+    hdr.version     = GALLERY_VERSION;
+    hdr.dtype       = dtype;
+    hdr.count       = n;
+    hdr.dim         = dim;
+    hdr.model_hash  = model_hash;
+    hdr.data_offset = sizeof(GalleryHeader);
+    hdr.row_stride  = dim * (uint32_t)elem_size(dtype);
+    hdr.data_bytes  = data_size(dtype, n, dim);
+    hdr.data_crc    = crc(payload, hdr.data_bytes);
+    hdr.header_crc  = crc(&hdr, offsetof(GalleryHeader, header_crc));
+
+    // dot-prefixed temp name: never mistaken for a gallery by the watcher
+    std::string final_path = gallery_path(data_dir, user);
+    std::string tmp_path   = (dir / ("." + user + GALLERY_SUFFIX + ".tmp")).string();
+
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        spdlog::error("Cannot write {}: {}", tmp_path, std::strerror(errno));
+        return false;
+    }
+    bool ok = write_all(fd, &hdr, sizeof(hdr)) &&
+              write_all(fd, payload, hdr.data_bytes) &&
+              fsync(fd) == 0;
+    ok = (::close(fd) == 0) && ok;
+
+    if (!ok || rename(tmp_path.c_str(), final_path.c_str()) != 0) {
+        spdlog::error("Writing gallery {} failed: {}", final_path, std::strerror(errno));
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    // persist the rename itself
+    int dfd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd >= 0) {
+        fsync(dfd);
+        ::close(dfd);
+    }
+    return true;
+}
+
+// ------------------------------------------------------------
+//  Reading
+// ------------------------------------------------------------
+struct Mapping {
+    void*  addr;
+    size_t len;
+
+    Mapping(void* a, size_t n) : addr(a), len(n) {}
+    Mapping(const Mapping&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+    ~Mapping() { munmap(addr, len); }
+};
+
+static GalleryPtr map_gallery(const std::string& path, uint64_t model_hash,
+                              std::string& err) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        err = errno == ENOENT ? "not_enrolled" : "read_failed";
+        return nullptr;
+    }
+    struct stat st;
+    void* addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(GalleryHeader))
+        addr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        spdlog::error("Gallery file {} is truncated or unreadable", path);
+        err = "read_failed";
+        return nullptr;
+    }
+    auto map = std::make_shared<Mapping>(addr, (size_t)st.st_size);
+
+    const auto* base = static_cast<const uint8_t*>(addr);
+    GalleryHeader hdr;
+    std::memcpy(&hdr, base, sizeof(hdr));
+
+    bool valid =
+        hdr.magic == GALLERY_MAGIC && hdr.version == GALLERY_VERSION &&
+        hdr.header_crc == crc(&hdr, offsetof(GalleryHeader, header_crc)) &&
+        elem_size(hdr.dtype) != 0 &&
+        hdr.count > 0 && hdr.count <= MAX_TEMPLATES &&
+        hdr.dim > 0 && hdr.dim <= MAX_DIM &&
+        hdr.row_stride == hdr.dim * elem_size(hdr.dtype) &&
+        hdr.data_bytes == data_size(hdr.dtype, hdr.count, hdr.dim) &&
+        hdr.data_offset % 64 == 0 &&
+        hdr.data_offset >= sizeof(GalleryHeader) &&
+        hdr.data_offset + hdr.data_bytes <= map->len &&
+        hdr.data_crc == crc(base + hdr.data_offset, hdr.data_bytes);
+    if (!valid) {
+        spdlog::error("Gallery file {} is corrupt or from an unsupported version", path);
+        err = "read_failed";
+        return nullptr;
+    }
+    if (model_hash && hdr.model_hash && hdr.model_hash != model_hash) {
+        spdlog::warn("Gallery {} was enrolled with a different model", path);
+        err = "model_mismatch";
+        return nullptr;
+    }
+
+    // no copy: the scorer reads the mapped matrix directly
+    const uint8_t* data   = base + hdr.data_offset;
+    const float*   scales = nullptr;
+    if (hdr.dtype == GALLERY_I8)
+        scales = reinterpret_cast<const float*>(
+            data + align64((uint64_t)hdr.count * hdr.row_stride));
+    return std::make_shared<Gallery>(hdr.count, hdr.dim, hdr.model_hash,
+                                     (GalleryDType)hdr.dtype, data, scales,
+                                     std::move(map));
+}
+
+// Pre-v2.2 format: uint32 N, uint32 D, then N*D floats
+static bool migrate_legacy(const std::string& data_dir, const std::string& user,
+                           uint64_t model_hash) {
+    std::string legacy = (fs::path(data_dir) / (user + LEGACY_SUFFIX)).string();
+    FILE* f = fopen(legacy.c_str(), "rb");
+    if (!f) return false;
+
+    uint32_t N = 0, D = 0;
+    std::vector<float> rows;
+    bool ok = fread(&N, sizeof(N), 1, f) == 1 && fread(&D, sizeof(D), 1, f) == 1 &&
+              N > 0 && D > 0 && N <= MAX_TEMPLATES && D <= MAX_DIM;
+    if (ok) {
+        rows.resize((size_t)N * D);
+        ok = fread(rows.data(), sizeof(float) * D, N, f) == N;
+    }
+    fclose(f);
+
+    if (!ok) {
+        spdlog::error("Legacy gallery {} is truncated, not migrating", legacy);
+        return false;
+    }
+    if (!save_gallery(data_dir, user, rows.data(), N, D, model_hash))
+        return false;
+
+    std::error_code ec;
+    fs::rename(legacy, legacy + ".migrated", ec);
+    spdlog::info("Migrated {} to {}", legacy, gallery_path(data_dir, user));
+    return true;
+}
+
+GalleryPtr facelock::load_gallery(const std::string& data_dir,
+                                  const std::string& user,
+                                  uint64_t model_hash, std::string& err) {
+    std::string path = gallery_path(data_dir, user);
+    GalleryPtr g = map_gallery(path, model_hash, err);
+    if (!g && err == "not_enrolled" && migrate_legacy(data_dir, user, model_hash))
+        g = map_gallery(path, model_hash, err);
+    return g;
+}
+
+// ============================================================
+//  Adaptive templates
+// ============================================================
+
+// retired records tolerated before the log is rewritten compactly
+static constexpr uint32_t ADAPT_MAX_DEAD = 64;
+
+std::string facelock::adaptive_path(const std::string& data_dir,
+                                    const std::string& user) {
+    return (fs::path(data_dir) / (user + ADAPT_SUFFIX)).string();
+}
+
+static uint32_t record_crc(const AdaptRecord& r, const float* row, uint32_t dim) {
+    uLong c = crc32(0L, Z_NULL, 0);
+    c = crc32(c, reinterpret_cast<const Bytef*>(&r), offsetof(AdaptRecord, crc));
+    if (row) c = crc32(c, reinterpret_cast<const Bytef*>(row), dim * sizeof(float));
+    return (uint32_t)c;
+}
+
+static void put_record(std::vector<uint8_t>& buf, AdaptOp op, uint32_t seq,
+                       uint64_t time, float score, const float* row, uint32_t dim) {
+    AdaptRecord r;
+    std::memset(&r, 0, sizeof(r));
+    r.op    = op;
+    r.seq   = seq;
+    r.time  = time;
+    r.score = score;
+    r.crc   = record_crc(r, row, dim);
+    auto* p = reinterpret_cast<const uint8_t*>(&r);
+    buf.insert(buf.end(), p, p + sizeof(r));
+    if (row) {
+        auto* f = reinterpret_cast<const uint8_t*>(row);
+        buf.insert(buf.end(), f, f + dim * sizeof(float));
+    }
+}
+
+static void put_header(std::vector<uint8_t>& buf, uint32_t dim, uint64_t model_hash) {
+    AdaptFileHeader h;
+    std::memset(&h, 0, sizeof(h));
+    h.magic      = ADAPT_MAGIC;
+    h.version    = ADAPT_VERSION;
+    h.dim        = dim;
+    h.model_hash = model_hash;
+    h.header_crc = crc(&h, offsetof(AdaptFileHeader, header_crc));
+    auto* p = reinterpret_cast<const uint8_t*>(&h);
+    buf.insert(buf.end(), p, p + sizeof(h));
+}
+
+static void fsync_dir(const std::string& data_dir) {
+    int dfd = ::open(data_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd >= 0) {
+        fsync(dfd);
+        ::close(dfd);
+    }
+}
+
+bool facelock::read_adaptive(const std::string& data_dir, const std::string& user,
+                             uint64_t model_hash, AdaptiveLog& out) {
+    out = AdaptiveLog{};
+    std::string path = adaptive_path(data_dir, user);
+    FILE* f = fopen(path.c_str(), "rbe");
+    if (!f) return false;
+    std::vector<uint8_t> buf;
+    uint8_t chunk[16384];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), f)) > 0)
+        buf.insert(buf.end(), chunk, chunk + got);
+    fclose(f);
+
+    AdaptFileHeader h;
+    if (buf.size() < sizeof(h)) return false;
+    std::memcpy(&h, buf.data(), sizeof(h));
+    if (h.magic != ADAPT_MAGIC || h.version != ADAPT_VERSION ||
+        h.header_crc != crc(&h, offsetof(AdaptFileHeader, header_crc)) ||
+        h.dim == 0 || h.dim > MAX_DIM) {
+        spdlog::error("Adaptive log {} is corrupt, ignoring it", path);
+        return false;
+    }
+    if (model_hash && h.model_hash && h.model_hash != model_hash) {
+        spdlog::warn("Adaptive log {} was learned with a different model", path);
+        return false;
+    }
+
+    out.dim        = h.dim;
+    out.model_hash = h.model_hash;
+    size_t pos = sizeof(h);
+    const size_t row_bytes = (size_t)h.dim * sizeof(float);
+    while (pos + sizeof(AdaptRecord) <= buf.size()) {
+        AdaptRecord r;
+        std::memcpy(&r, buf.data() + pos, sizeof(r));
+        const bool add = r.op == ADAPT_ADD;
+        if ((!add && r.op != ADAPT_DROP) ||
+            (add && pos + sizeof(r) + row_bytes > buf.size()))
+            break;
+
+        std::vector<float> row;
+        if (add) {
+            row.resize(h.dim);
+            std::memcpy(row.data(), buf.data() + pos + sizeof(r), row_bytes);
+        }
+        if (r.crc != record_crc(r, add ? row.data() : nullptr, h.dim)) break;
+
+        if (add) {
+            out.live.push_back({r.seq, r.time, r.score, std::move(row)});
+        } else {
+            auto it = std::find_if(out.live.begin(), out.live.end(),
+                                   [&](const AdaptiveTemplate& t) { return t.seq == r.seq; });
+            if (it != out.live.end()) out.live.erase(it);
+        }
+        out.next_seq = std::max(out.next_seq, r.seq + 1);
+        ++out.records;
+        pos += sizeof(r) + (add ? row_bytes : 0);
+    }
+    if (pos != buf.size())
+        spdlog::warn("Adaptive log {} has a torn tail at byte {}, ignoring it", path, pos);
+    out.valid_bytes = pos;
+    return true;
+}
+
+// Replace the log with one holding only the live templates
+static bool rewrite_adaptive(const std::string& data_dir, const std::string& user,
+                             AdaptiveLog& log) {
+    std::vector<uint8_t> buf;
+    put_header(buf, log.dim, log.model_hash);
+    for (const auto& t : log.live)
+        put_record(buf, ADAPT_ADD, t.seq, t.time, t.score, t.row.data(), log.dim);
+
+    std::string path = adaptive_path(data_dir, user);
+    std::string tmp  = (fs::path(data_dir) / ("." + user + ADAPT_SUFFIX + ".tmp")).string();
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return false;
+    bool ok = write_all(fd, buf.data(), buf.size()) && fsync(fd) == 0;
+    ok = (::close(fd) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        spdlog::error("Rewriting adaptive log {} failed: {}", path, std::strerror(errno));
+        unlink(tmp.c_str());
+        return false;
+    }
+    fsync_dir(data_dir);
+    log.records     = (uint32_t)log.live.size();
+    log.valid_bytes = buf.size();
+    return true;
+}
+
+bool facelock::append_adaptive(const std::string& data_dir, const std::string& user,
+                               AdaptiveLog& log, const float* row, float score,
+                               uint32_t drop_seq) {
+    if (!row || log.dim == 0 || log.dim > MAX_DIM) return false;
+
+    AdaptiveTemplate t{log.next_seq, (uint64_t)std::time(nullptr), score,
+                       std::vector<float>(row, row + log.dim)};
+    AdaptiveLog next = log;
+    if (drop_seq) {
+        auto it = std::find_if(next.live.begin(), next.live.end(),
+                               [&](const AdaptiveTemplate& a) { return a.seq == drop_seq; });
+        if (it != next.live.end()) next.live.erase(it);
+    }
+    next.live.push_back(t);
+    next.next_seq = t.seq + 1;
+
+    const uint32_t written = drop_seq ? 2 : 1;
+    if (log.valid_bytes > 0 &&
+        log.records + written - next.live.size() > ADAPT_MAX_DEAD) {
+        if (!rewrite_adaptive(data_dir, user, next)) return false;
+        log = std::move(next);
+        return true;
+    }
+
+    std::vector<uint8_t> buf;
+    if (log.valid_bytes == 0) put_header(buf, log.dim, log.model_hash);
+    if (drop_seq) put_record(buf, ADAPT_DROP, drop_seq, t.time, 0.f, nullptr, log.dim);
+    put_record(buf, ADAPT_ADD, t.seq, t.time, score, t.row.data(), log.dim);
+
+    std::string path = adaptive_path(data_dir, user);
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        spdlog::error("Cannot write {}: {}", path, std::strerror(errno));
+        return false;
+    }
+    // drop a torn tail (or a header-less file) before appending
+    bool ok = ftruncate(fd, (off_t)log.valid_bytes) == 0 &&
+              lseek(fd, 0, SEEK_END) == (off_t)log.valid_bytes &&
+              write_all(fd, buf.data(), buf.size()) &&
+              fsync(fd) == 0;
+    ok = (::close(fd) == 0) && ok;
+    if (!ok) {
+        spdlog::error("Appending to adaptive log {} failed: {}", path, std::strerror(errno));
+        return false;
+    }
+    if (log.valid_bytes == 0) fsync_dir(data_dir);
+
+    next.records     = log.records + written;
+    next.valid_bytes = log.valid_bytes + buf.size();
+    log = std::move(next);
+    return true;
+}
+
+bool facelock::remove_adaptive(const std::string& data_dir, const std::string& user) {
+    if (unlink(adaptive_path(data_dir, user).c_str()) != 0) return false;
+    fsync_dir(data_dir);
+    return true;
+}
+
+GalleryPtr facelock::merge_adaptive(const Gallery& base, const AdaptiveLog& log) {
+    const uint32_t dim = base.dim();
+    const uint32_t n0  = base.size();
+    const uint32_t n   = n0 + (uint32_t)log.live.size();
+    if (log.dim != dim || n == n0) return nullptr;
+
+    const uint16_t dtype  = base.dtype();
+    const size_t   stride = (size_t)dim * elem_size(dtype);
+    const uint64_t bytes  = data_size(dtype, n, dim);
+    void* block = aligned_alloc(64, align64(bytes));
+    if (!block) return nullptr;
+    std::shared_ptr<const void> storage(block, free);
+
+    auto* rows = static_cast<uint8_t*>(block);
+    std::memcpy(rows, base.rows(), n0 * stride);
+    float* scales = nullptr;
+    if (dtype == GALLERY_I8) {
+        scales = reinterpret_cast<float*>(rows + align64((uint64_t)n * stride));
+        std::memcpy(scales, base.scales(), n0 * sizeof(float));
+    }
+
+    for (uint32_t i = 0; i < (uint32_t)log.live.size(); ++i) {
+        const float* src = log.live[i].row.data();
+        uint8_t*     dst = rows + (size_t)(n0 + i) * stride;
+        if (dtype == GALLERY_F16) {
+            auto* h = reinterpret_cast<uint16_t*>(dst);
+            for (uint32_t j = 0; j < dim; ++j) h[j] = float_to_half(src[j]);
+        } else if (dtype == GALLERY_I8) {
+            scales[n0 + i] = quantize_i8(src, dim, reinterpret_cast<int8_t*>(dst));
+        } else {
+            std::memcpy(dst, src, stride);
+        }
+    }
+    return std::make_shared<Gallery>(n, dim, base.model_hash(), base.dtype(),
+                                     rows, scales, std::move(storage));
 }
@@ -0,0 +1,63 @@
+#include "facelock/systemd.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+
+using namespace facelock;
+
+// First fd passed by systemd (SD_LISTEN_FDS_START)
+static constexpr int LISTEN_FDS_START = 3;
+
+// Implemented by hand so the daemon does not need libsystemd
+bool facelock::sd_notify_state(const std::string& state) {
+    const char* path = std::getenv("NOTIFY_SOCKET");
+    if (!path || !*path) return false;
+
+    size_t len = std::strlen(path);
+    sockaddr_un addr{};
+    if (len >= sizeof(addr.sun_path)) return false;
+    if (path[0] != '/' && path[0] != '@') return false;
+
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path, len);
+    if (addr.sun_path[0] == '@') addr.sun_path[0] = '\0';   // abstract namespace
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+
+    socklen_t alen = (socklen_t)(offsetof(sockaddr_un, sun_path) + len);
+    ssize_t n = sendto(fd, state.data(), state.size(), MSG_NOSIGNAL,
+                       reinterpret_cast<sockaddr*>(&addr), alen);
+    close(fd);
+    return n == (ssize_t)state.size();
+}
+
+int facelock::sd_listen_fd() {
+    const char* pid = std::getenv("LISTEN_PID");
+    const char* fds = std::getenv("LISTEN_FDS");
+    long n = 0;
+    if (pid && fds && std::strtol(pid, nullptr, 10) == (long)getpid())
+        n = std::strtol(fds, nullptr, 10);
+
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+    if (n < 1) return -1;
+
+    // only the first socket is used; none of them may leak into the helper
+    for (long i = 0; i < n; ++i)
+        fcntl(LISTEN_FDS_START + (int)i, F_SETFD, FD_CLOEXEC);
+
+    int fd = LISTEN_FDS_START;
+    int listening = 0;
+    socklen_t len = sizeof(listening);
+    if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) < 0 || !listening)
+        return -1;
+    return fd;
+}
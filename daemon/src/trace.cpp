@@ -0,0 +1,212 @@
+#include "facelock/trace.h"
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <filesystem>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <spdlog/spdlog.h>
+
+using namespace facelock;
+namespace fs = std::filesystem;
+
+static_assert((TRACE_RING_EVENTS & (TRACE_RING_EVENTS - 1)) == 0,
+              "TRACE_RING_EVENTS must be a power of two");
+
+std::atomic<bool> trace_detail::enabled{false};
+
+// Other processes we keep a name for (helpers come and go)
+static constexpr size_t MAX_PROCESS_NAMES = 16;
+
+static const int SELF_PID = (int)getpid();
+
+// ------------------------------------------------------------
+//  Per-thread ring. Only the owning thread writes; a dump reads it
+//  concurrently. `claimed` moves before a slot is overwritten and
+//  `published` after, so the reader can tell which slots it may
+//  have caught half-written and drop them.
+// ------------------------------------------------------------
+namespace {
+struct Slot {
+    std::atomic<const char*> name{nullptr};
+    std::atomic<uint64_t>    start{0};
+    std::atomic<uint64_t>    end{0};
+    std::atomic<uint64_t>    ids{0};   // pid << 32 | tid
+};
+
+struct Ring {
+    Slot                  slots[TRACE_RING_EVENTS];
+    std::atomic<uint64_t> claimed{0};
+    std::atomic<uint64_t> published{0};
+    bool                  in_use = false;   // a live thread owns it (registry lock)
+};
+
+struct Registry {
+    std::mutex                         mtx;
+    std::vector<std::unique_ptr<Ring>> rings;
+    std::map<int, std::string>         processes;
+    bool                               full_warned = false;
+};
+
+// never destroyed: threads may still exit (and hand back their ring)
+// after static destructors ran
+Registry& registry() {
+    static Registry* r = new Registry;
+    return *r;
+}
+
+// The calling thread's ring, taken on its first span and handed back
+// for the next new thread when it exits. Spans already in it stay
+// until overwritten; each one carries its own thread id.
+struct Lease {
+    Ring* ring  = nullptr;
+    int   tid   = 0;
+    bool  tried = false;   // no ring after trying: all TRACE_MAX_RINGS taken
+
+    ~Lease() {
+        if (!ring) return;
+        std::lock_guard<std::mutex> lk(registry().mtx);
+        ring->in_use = false;
+    }
+};
+
+thread_local Lease lease;
+
+Ring* my_ring() {
+    if (lease.ring || lease.tried) return lease.ring;
+    lease.tried = true;
+    lease.tid   = (int)syscall(SYS_gettid);
+
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lk(reg.mtx);
+    for (auto& r : reg.rings)
+        if (!r->in_use) { lease.ring = r.get(); break; }
+    if (!lease.ring && reg.rings.size() < TRACE_MAX_RINGS) {
+        reg.rings.push_back(std::make_unique<Ring>());
+        lease.ring = reg.rings.back().get();
+    }
+    if (!lease.ring) {
+        if (!reg.full_warned)
+            spdlog::warn("Trace: more than {} threads, spans of the others are dropped",
+                         TRACE_MAX_RINGS);
+        reg.full_warned = true;
+        return nullptr;
+    }
+    lease.ring->in_use = true;
+    return lease.ring;
+}
+
+struct Event {
+    const char* name;
+    uint64_t    start, end, ids;
+};
+} // namespace
+
+uint64_t facelock::trace_now() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void trace_detail::record(const char* name, uint64_t start_ns, uint64_t end_ns,
+                          int pid, int tid) {
+    Ring* r = my_ring();
+    if (!r) return;
+
+    uint64_t i = r->claimed.load(std::memory_order_relaxed);
+    r->claimed.store(i + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    Slot& s = r->slots[i & (TRACE_RING_EVENTS - 1)];
+    s.name.store(name, std::memory_order_relaxed);
+    s.start.store(start_ns, std::memory_order_relaxed);
+    s.end.store(std::max(start_ns, end_ns), std::memory_order_relaxed);
+    s.ids.store((uint64_t)(uint32_t)(pid ? pid : SELF_PID) << 32 |
+                (uint32_t)(tid ? tid : lease.tid), std::memory_order_relaxed);
+
+    r->published.store(i + 1, std::memory_order_release);
+}
+
+void facelock::trace_enable(bool on) {
+    trace_detail::enabled.store(on, std::memory_order_relaxed);
+}
+
+void facelock::trace_process_name(int pid, const std::string& name) {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lk(reg.mtx);
+    reg.processes[pid] = name;
+    while (reg.processes.size() > MAX_PROCESS_NAMES)
+        reg.processes.erase(reg.processes.begin());
+}
+
+// ------------------------------------------------------------
+//  Chrome trace export — complete ("X") events in microseconds,
+//  plus process name metadata; loads in chrome://tracing and
+//  ui.perfetto.dev
+// ------------------------------------------------------------
+json facelock::trace_dump() {
+    std::vector<Event> events;
+    json meta = json::array();
+    {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lk(reg.mtx);
+        for (auto& r : reg.rings) {
+            uint64_t hi = r->published.load(std::memory_order_acquire);
+            uint64_t lo = hi > TRACE_RING_EVENTS ? hi - TRACE_RING_EVENTS : 0;
+            size_t first = events.size();
+            for (uint64_t i = lo; i < hi; ++i) {
+                const Slot& s = r->slots[i & (TRACE_RING_EVENTS - 1)];
+                events.push_back({s.name.load(std::memory_order_relaxed),
+                                  s.start.load(std::memory_order_relaxed),
+                                  s.end.load(std::memory_order_relaxed),
+                                  s.ids.load(std::memory_order_relaxed)});
+            }
+            // slots the owner started overwriting while we copied
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t claimed = r->claimed.load(std::memory_order_relaxed);
+            uint64_t valid   = claimed > TRACE_RING_EVENTS ? claimed - TRACE_RING_EVENTS : 0;
+            if (valid > lo)
+                events.erase(events.begin() + first,
+                             events.begin() + first + (size_t)std::min(valid - lo, hi - lo));
+        }
+        meta.push_back({{"name","process_name"},{"ph","M"},{"pid",SELF_PID},
+                        {"tid",0},{"args",{{"name","facelockd"}}}});
+        for (const auto& [pid, name] : reg.processes)
+            meta.push_back({{"name","process_name"},{"ph","M"},{"pid",pid},
+                            {"tid",0},{"args",{{"name",name}}}});
+    }
+
+    std::sort(events.begin(), events.end(),
+              [](const Event& a, const Event& b) { return a.start < b.start; });
+    json out = std::move(meta);
+    for (const auto& e : events)
+        out.push_back({{"name",e.name},{"cat","facelock"},{"ph","X"},
+                       {"ts",(double)e.start / 1000.0},
+                       {"dur",(double)(e.end - e.start) / 1000.0},
+                       {"pid",(int)(e.ids >> 32)},{"tid",(int)(uint32_t)e.ids}});
+    return {{"traceEvents",std::move(out)},{"displayTimeUnit","ms"}};
+}
+
+// Written to a temp name and renamed so a reader never sees half a file
+bool facelock::trace_write(const std::string& path) {
+    std::error_code ec;
+    std::string tmp = path + ".tmp" + std::to_string(SELF_PID);
+    {
+        std::ofstream f(tmp, std::ios::trunc);
+        f << trace_dump().dump();
+        if (!f.flush()) {
+            fs::remove(tmp, ec);
+            return false;
+        }
+    }
+    fs::rename(tmp, path, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
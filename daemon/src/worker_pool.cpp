@@ -0,0 +1,56 @@
+#include "facelock/worker_pool.h"
+
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+using namespace facelock;
+
+WorkerPool::WorkerPool(size_t threads, size_t max_queue)
+    : max_queue_(std::max<size_t>(1, max_queue)) {
+    threads = std::max<size_t>(1, threads);
+    threads_.reserve(threads);
+    for (size_t i = 0; i < threads; ++i)
+        threads_.emplace_back(&WorkerPool::run, this);
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : threads_) t.join();
+}
+
+bool WorkerPool::submit(Job job) {
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (stopping_ || jobs_.size() >= max_queue_) return false;
+        jobs_.push_back(std::move(job));
+    }
+    cv_.notify_one();
+    return true;
+}
+
+size_t WorkerPool::queued() const {
+    std::lock_guard<std::mutex> lk(mtx_);
+    return jobs_.size();
+}
+
+void WorkerPool::run() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lk(mtx_);
+            cv_.wait(lk, [this] { return stopping_ || !jobs_.empty(); });
+            if (jobs_.empty()) return;   // stopping and drained
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+        try {
+            job();
+        } catch (const std::exception& e) {
+            spdlog::error("Worker job failed: {}", e.what());
+        }
+    }
+}
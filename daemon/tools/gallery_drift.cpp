@@ -0,0 +1,132 @@
+// facelock-gallery-drift — how much do f16 / int8 templates move scores?
+//
+// Re-embeds a user's enrollment samples (DATA_DIR/<user>/*.png) with the
+// fp32 model output as reference, then scores every sample against all
+// the others (leave-one-out) with f32, f16 and int8 templates and reports
+// the distance drift and any auth decisions that would flip.
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "facelock/onnx_wrapper.h"
+#include "facelock/similarity.h"
+
+using namespace facelock;
+namespace fs = std::filesystem;
+
+static const char* arg_value(int argc, char** argv, const char* flag,
+                             const char* fallback) {
+    for (int i = 1; i + 1 < argc; ++i)
+        if (std::strcmp(argv[i], flag) == 0) return argv[i + 1];
+    return fallback;
+}
+
+struct Drift {
+    double sum = 0.0, max = 0.0;
+    size_t n   = 0;
+    void   add(float a, float b) {
+        double d = std::fabs((double)a - b);
+        sum += d;
+        max  = std::max(max, d);
+        ++n;
+    }
+    double mean() const { return n ? sum / n : 0.0; }
+};
+
+// mean of the 3 smallest distances, skipping row `self`
+static float top3(const std::vector<float>& sims, size_t self) {
+    std::vector<float> d;
+    for (size_t j = 0; j < sims.size(); ++j)
+        if (j != self) d.push_back(1.f - sims[j]);
+    size_t k = std::min<size_t>(3, d.size());
+    std::partial_sort(d.begin(), d.begin() + k, d.end());
+    float s = 0.f;
+    for (size_t i = 0; i < k; ++i) s += d[i];
+    return k ? s / k : 1.f;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argv[1][0] == '-') {
+        std::fprintf(stderr,
+            "usage: %s <user> [--data-dir DIR] [--model PATH] [--threshold T]\n",
+            argv[0]);
+        return 2;
+    }
+    std::string user      = argv[1];
+    std::string data_dir  = arg_value(argc, argv, "--data-dir", "/var/lib/facelock");
+    std::string model     = arg_value(argc, argv, "--model",
+                                      "/usr/share/facelock/models/w600k_mbf.onnx");
+    float       threshold = std::stof(arg_value(argc, argv, "--threshold", "0.30"));
+
+    std::vector<cv::Mat> samples;
+    std::error_code ec;
+    for (auto& e : fs::directory_iterator(fs::path(data_dir) / user, ec)) {
+        if (e.path().extension() != ".png") continue;
+        cv::Mat img = cv::imread(e.path().string(), cv::IMREAD_COLOR);
+        if (!img.empty()) samples.push_back(img);
+    }
+    if (samples.size() < 2) {
+        std::fprintf(stderr, "need at least 2 enrollment samples in %s\n",
+                     (fs::path(data_dir) / user).c_str());
+        return 1;
+    }
+
+    cv::Mat emb;
+    try {
+        ONNXWrapper net(model);
+        emb = net.embed_batch(samples);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "embedding failed: %s\n", e.what());
+        return 1;
+    }
+    const size_t N = (size_t)emb.rows, D = (size_t)emb.cols;
+    const float* f32 = emb.ptr<float>(0);
+
+    std::vector<uint16_t> f16(N * D);
+    for (size_t i = 0; i < N * D; ++i) f16[i] = float_to_half(f32[i]);
+
+    std::vector<int8_t> i8(N * D);
+    std::vector<float>  scales(N);
+    for (size_t r = 0; r < N; ++r)
+        scales[r] = quantize_i8(f32 + r * D, D, i8.data() + r * D);
+
+    Drift dist16, dist8, score16, score8;
+    int   flips16 = 0, flips8 = 0;
+    std::vector<float> s32(N), s16(N), s8(N);
+    std::vector<int8_t> q8(D);
+
+    for (size_t i = 0; i < N; ++i) {
+        const float* q = f32 + i * D;
+        dot_rows(q, f32, N, D, s32.data());
+        dot_rows_f16(q, f16.data(), N, D, s16.data());
+        float qscale = quantize_i8(q, D, q8.data());
+        dot_rows_i8(q8.data(), qscale, i8.data(), scales.data(), N, D, s8.data());
+
+        for (size_t j = 0; j < N; ++j) {
+            if (j == i) continue;
+            dist16.add(s32[j], s16[j]);
+            dist8.add(s32[j], s8[j]);
+        }
+        float t32 = top3(s32, i), t16 = top3(s16, i), t8 = top3(s8, i);
+        score16.add(t32, t16);
+        score8.add(t32, t8);
+        flips16 += (t32 <= threshold) != (t16 <= threshold);
+        flips8  += (t32 <= threshold) != (t8 <= threshold);
+    }
+
+    std::printf("user %s: %zu samples x %zu dims, kernels %s\n",
+                user.c_str(), N, D, similarity_kernel_name());
+    std::printf("%-6s %12s %12s %12s %12s %7s\n",
+                "dtype", "dist mean", "dist max", "top3 mean", "top3 max", "flips");
+    std::printf("%-6s %12.2e %12.2e %12.2e %12.2e %7d\n", "f16",
+                dist16.mean(), dist16.max, score16.mean(), score16.max, flips16);
+    std::printf("%-6s %12.2e %12.2e %12.2e %12.2e %7d\n", "i8",
+                dist8.mean(), dist8.max, score8.mean(), score8.max, flips8);
+    return 0;
+}
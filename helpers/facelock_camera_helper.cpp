@@ -3,7 +3,22 @@
 #include <vector>
 #include <chrono>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <csignal>
+#include <poll.h>
+#include <unistd.h>
+
+#include "facelock/capture_protocol.h"
+#include "v4l2_capture.h"
+
+using namespace facelock;
 
 static const char* DETECTOR_MODEL =
     "/usr/share/facelock/models/retinaface.onnx";
@@ -29,6 +44,38 @@ static Mode parse_mode(int argc, char** argv) {
     return Mode::BGR112;
 }
 
+enum class Backend { AUTO, V4L2, OPENCV };
+
+static Backend parse_backend(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+            if (std::strcmp(argv[i+1], "v4l2")   == 0) return Backend::V4L2;
+            if (std::strcmp(argv[i+1], "opencv") == 0) return Backend::OPENCV;
+        }
+    }
+    return Backend::AUTO;
+}
+
+static bool has_flag(int argc, char** argv, const char* flag) {
+    for (int i = 1; i < argc; ++i)
+        if (std::strcmp(argv[i], flag) == 0) return true;
+    return false;
+}
+
+static int parse_int(int argc, char** argv, const char* flag, int def) {
+    for (int i = 1; i < argc; ++i)
+        if (std::strcmp(argv[i], flag) == 0 && i + 1 < argc)
+            return std::atoi(argv[i+1]);
+    return def;
+}
+
+static float parse_float(int argc, char** argv, const char* flag, float def) {
+    for (int i = 1; i < argc; ++i)
+        if (std::strcmp(argv[i], flag) == 0 && i + 1 < argc)
+            return std::strtof(argv[i+1], nullptr);
+    return def;
+}
+
 static int parse_camera(int argc, char** argv) {
     for (int i = 1; i < argc; ++i) {
         if (std::strcmp(argv[i], "--camera") == 0 && i + 1 < argc) {
@@ -38,8 +85,104 @@ static int parse_camera(int argc, char** argv) {
     return 0; // default: /dev/video0
 }
 
+static uint64_t monotonic_us() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+// ============================================================
+//  Frame sources
+//  v4l2:   mmap'd driver buffers; the detector sees a half-size BGR
+//          view and the 112x112 crop is warped straight from YUYV/MJPEG
+//  opencv: cv::VideoCapture full-frame BGR (fallback)
+// ============================================================
+// Frames the --serve ring keeps. Each one pins its driver buffer.
+static constexpr size_t FRAME_RING_SLOTS = 4;
+
+// Driver buffers needed so capture never stalls: the full ring, the
+// frame being detected, and one queued in the driver
+static constexpr uint32_t V4L2_MIN_BUFFERS = FRAME_RING_SLOTS + 2;
+
+struct Frame {
+    cv::Mat  image;                 // detector input (BGR)
+    float    scale = 1.f;           // frame coords = image coords * scale
+    uint64_t timestamp_us = 0;
+    std::shared_ptr<const V4L2Buffer> raw;  // v4l2 backend only
+};
+
+class FrameSource {
+public:
+    bool open(int cam, Backend backend) {
+        if (backend != Backend::OPENCV && open_v4l2(cam)) return true;
+        if (backend == Backend::V4L2) return false;
+        return open_opencv(cam);
+    }
+
+    bool read(Frame& f) {
+        if (use_v4l2_) {
+            auto buf = v4l2_.grab();
+            if (!buf || !v4l2_detector_view(*buf, f.image)) return false;
+            f.scale        = 2.f;
+            f.timestamp_us = buf->timestamp_us;
+            f.raw          = std::move(buf);
+            return true;
+        }
+        f.raw.reset();
+        f.scale = 1.f;
+        if (!cap_.read(f.image) || f.image.empty()) return false;
+        f.timestamp_us = monotonic_us();
+        return true;
+    }
+
+    bool is_v4l2() const { return use_v4l2_; }
+    cv::Size detector_size() const { return detector_size_; }
+
+private:
+    cv::VideoCapture cap_;
+    V4L2Capture      v4l2_;
+    bool             use_v4l2_ = false;
+    cv::Size         detector_size_{640, 480};
+
+    bool open_v4l2(int cam) {
+        if (!v4l2_.open(cam, 640, 480, V4L2_MIN_BUFFERS)) return false;
+
+        // make sure we can actually decode what the driver hands us
+        // (some MJPEG-only cameras omit Huffman tables)
+        use_v4l2_ = true;
+        Frame probe;
+        for (int i = 0; i < 5; ++i) {
+            if (read(probe)) {
+                detector_size_ = probe.image.size();
+                return true;
+            }
+        }
+        use_v4l2_ = false;
+        v4l2_.close();
+        return false;
+    }
+
+    bool open_opencv(int cam) {
+        if (!cap_.open(cam)) return false;
+        cap_.set(cv::CAP_PROP_FRAME_WIDTH,  640);
+        cap_.set(cv::CAP_PROP_FRAME_HEIGHT, 480);
+        return cap_.isOpened();
+    }
+};
+
+// Detect faces on the frame's detector view; coordinates in the result
+// are rescaled to full-frame coordinates.
+static void detect_faces(cv::Ptr<cv::FaceDetectorYN>& detector,
+                         const Frame& frame, cv::Mat& faces) {
+    detector->detect(frame.image, faces);
+    if (frame.scale == 1.f) return;
+    for (int r = 0; r < faces.rows; ++r)
+        for (int c = 0; c < 14; ++c)
+            faces.at<float>(r, c) *= frame.scale;
+}
+
 // Align face to ArcFace canonical positions using landmarks
-static cv::Mat align_face(const cv::Mat& frame, const cv::Mat& faces, int idx) {
+static cv::Mat align_face(const Frame& frame, const cv::Mat& faces, int idx) {
     cv::Point2f src[5] = {
         {faces.at<float>(idx, 4),  faces.at<float>(idx, 5)},   // left eye
         {faces.at<float>(idx, 6),  faces.at<float>(idx, 7)},   // right eye
@@ -54,74 +197,538 @@ static cv::Mat align_face(const cv::Mat& frame, const cv::Mat& faces, int idx) {
     );
 
     cv::Mat aligned;
-    cv::warpAffine(frame, aligned, transform, {112, 112},
+    if (frame.raw) {
+        if (!v4l2_warp(*frame.raw, transform, {112, 112}, aligned)) return {};
+        return aligned;
+    }
+    cv::warpAffine(frame.image, aligned, transform, {112, 112},
                    cv::INTER_LINEAR, cv::BORDER_REFLECT);
     return aligned;
 }
 
+// Index of the highest-confidence face, or -1 if none
+static int best_face(const cv::Mat& faces) {
+    if (faces.rows <= 0) return -1;
+    int best = 0;
+    float best_score = faces.at<float>(0, 14);
+    for (int i = 1; i < faces.rows; ++i) {
+        float s = faces.at<float>(i, 14);
+        if (s > best_score) { best_score = s; best = i; }
+    }
+    return best;
+}
+
+// Produce the output blob for the requested mode; empty on failure
+static cv::Mat make_output(Mode mode, const Frame& frame,
+                           const cv::Mat& faces, int best) {
+    if (mode == Mode::BGR112)
+        return align_face(frame, faces, best);
+
+    // legacy gray200 — no alignment, cropped from the detector view
+    const cv::Mat& img = frame.image;
+    int x = std::max(0, (int)(faces.at<float>(best, 0) / frame.scale));
+    int y = std::max(0, (int)(faces.at<float>(best, 1) / frame.scale));
+    int w = std::min((int)(faces.at<float>(best, 2) / frame.scale), img.cols - x);
+    int h = std::min((int)(faces.at<float>(best, 3) / frame.scale), img.rows - y);
+    if (w <= 0 || h <= 0) return {};
+
+    cv::Mat gray;
+    cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+    cv::Mat crop = gray(cv::Rect(x,y,w,h)).clone();
+    cv::resize(crop, crop, {200, 200});
+    return crop;
+}
+
+static size_t output_size(Mode mode) {
+    return mode == Mode::BGR112 ? 112 * 112 * 3 : 200 * 200;
+}
+
+static bool write_all(int fd, const void* buf, size_t n) {
+    const char* p = static_cast<const char*>(buf);
+    while (n > 0) {
+        ssize_t w = ::write(fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w;
+        n -= (size_t)w;
+    }
+    return true;
+}
+
+// ============================================================
+//  Face quality — every detected face is checked and scored here,
+//  before it costs a record, a pipe copy or an embedding. Cheap
+//  checks on the detector row (confidence, size, landmark pose)
+//  run first; only faces passing them are aligned and measured.
+// ============================================================
+struct QualityGates {
+    float min_confidence = 0.7f;
+    float min_face       = 80.f;    // bbox width, frame pixels
+    float max_yaw        = 0.35f;
+    float max_pitch      = 0.25f;
+    float min_sharpness  = 30.f;    // Laplacian variance of the crop
+    float min_brightness = 20.f;
+    float max_brightness = 240.f;
+    float good           = 0.8f;    // sent at once, without waiting out the window
+    int   window         = 3;       // frames a held face competes over
+
+    static QualityGates parse(int argc, char** argv) {
+        QualityGates g;
+        g.min_confidence = parse_float(argc, argv, "--min-confidence", g.min_confidence);
+        g.min_face       = parse_float(argc, argv, "--min-face",       g.min_face);
+        g.max_yaw        = parse_float(argc, argv, "--max-yaw",        g.max_yaw);
+        g.max_pitch      = parse_float(argc, argv, "--max-pitch",      g.max_pitch);
+        g.min_sharpness  = parse_float(argc, argv, "--min-sharpness",  g.min_sharpness);
+        g.window         = std::max(1, parse_int(argc, argv, "--window", g.window));
+        return g;
+    }
+};
+
+// While streaming without a face passing, rejects are reported this often
+static constexpr auto REJECT_REPORT_INTERVAL = std::chrono::milliseconds(250);
+
+// nose height between the eye and mouth midpoints in ARCFACE_DST
+static constexpr float CANONICAL_PITCH = 0.495f;
+
+// A face that passed every check, ready to be sent
+struct Candidate {
+    cv::Mat  out;
+    uint64_t timestamp_us = 0;
+    float    score = 0.f, sharpness = 0.f, brightness = 0.f;
+    float    quality = 0.f, yaw = 0.f, pitch = 0.f;
+    float    bbox[4] = {}, landmarks[10] = {};
+    uint64_t detect_us = 0, align_us = 0;   // stage times, for the daemon's trace
+};
+
+using RejectCounts = uint16_t[CAPTURE_REJECT_COUNT];
+
+static float clamp01(float v) { return std::min(1.f, std::max(0.f, v)); }
+
+// Yaw and pitch from the five landmarks, measured in the eye-line frame
+// so head roll (which alignment removes anyway) does not read as either.
+// Both are 0 for a face looking straight at the camera.
+static bool landmark_pose(const cv::Mat& faces, int r, float& yaw, float& pitch) {
+    cv::Point2f le(faces.at<float>(r, 4),  faces.at<float>(r, 5));
+    cv::Point2f re(faces.at<float>(r, 6),  faces.at<float>(r, 7));
+    cv::Point2f no(faces.at<float>(r, 8),  faces.at<float>(r, 9));
+    cv::Point2f lm(faces.at<float>(r, 10), faces.at<float>(r, 11));
+    cv::Point2f rm(faces.at<float>(r, 12), faces.at<float>(r, 13));
+
+    cv::Point2f eye = (le + re) * 0.5f, mouth = (lm + rm) * 0.5f;
+    cv::Point2f ex  = re - le;
+    float d = std::sqrt(ex.x * ex.x + ex.y * ex.y);
+    if (d < 1.f) return false;
+    cv::Point2f ux = ex * (1.f / d), uy(-ux.y, ux.x);   // along / down the face
+
+    cv::Point2f n = no - eye, m = mouth - eye;
+    float down_m = m.dot(uy);
+    if (down_m <= 0.f) return false;
+    yaw   = n.dot(ux) / d;
+    pitch = n.dot(uy) / down_m - CANONICAL_PITCH;
+    return true;
+}
+
+// Check every face in `faces`; the best one that passes goes to `best`
+// (if it beats what is there), each one that fails is counted. Returns
+// how many passed. `detect_us` is the detector time of the frame.
+static int score_faces(Mode mode, const Frame& frame, const cv::Mat& faces,
+                        uint64_t detect_us, const QualityGates& g,
+                        RejectCounts rejects, Candidate& best, bool& have) {
+    int passed = 0;
+    for (int r = 0; r < faces.rows; ++r) {
+        float conf = faces.at<float>(r, 14);
+        float w    = faces.at<float>(r, 2);
+        float yaw = 0.f, pitch = 0.f;
+        if (conf < g.min_confidence)  { ++rejects[REJECT_CONFIDENCE]; continue; }
+        if (w < g.min_face)           { ++rejects[REJECT_SIZE];       continue; }
+        if (!landmark_pose(faces, r, yaw, pitch) ||
+            std::fabs(yaw) > g.max_yaw || std::fabs(pitch) > g.max_pitch) {
+            ++rejects[REJECT_POSE];
+            continue;
+        }
+
+        uint64_t t0 = monotonic_us();
+        cv::Mat out = make_output(mode, frame, faces, r);
+        if (out.empty()) continue;
+
+        cv::Mat gray, lap;
+        if (out.channels() == 3) cv::cvtColor(out, gray, cv::COLOR_BGR2GRAY);
+        else                     gray = out;
+        cv::Laplacian(gray, lap, CV_64F);
+        cv::Scalar mean, stddev;
+        cv::meanStdDev(lap, mean, stddev);
+        float sharpness  = (float)(stddev.val[0] * stddev.val[0]);
+        float brightness = (float)cv::mean(gray).val[0];
+        if (sharpness  < g.min_sharpness)  { ++rejects[REJECT_BLUR];   continue; }
+        if (brightness < g.min_brightness) { ++rejects[REJECT_DARK];   continue; }
+        if (brightness > g.max_brightness) { ++rejects[REJECT_BRIGHT]; continue; }
+        ++passed;
+
+        float q = 0.30f * clamp01(sharpness / (4.f * g.min_sharpness)) +
+                  0.25f * clamp01(1.f - std::max(std::fabs(yaw) / g.max_yaw,
+                                                 std::fabs(pitch) / g.max_pitch)) +
+                  0.20f * clamp01((conf - g.min_confidence) / (1.f - g.min_confidence)) +
+                  0.15f * clamp01(1.f - std::fabs(brightness - 128.f) / 128.f) +
+                  0.10f * clamp01(w / (2.f * g.min_face));
+        if (have && q <= best.quality) continue;
+        uint64_t align_us = monotonic_us() - t0;
+
+        have = true;
+        best.out          = out;
+        best.timestamp_us = frame.timestamp_us;
+        best.score        = conf;
+        best.sharpness    = sharpness;
+        best.brightness   = brightness;
+        best.quality      = q;
+        best.yaw          = yaw;
+        best.pitch        = pitch;
+        best.detect_us    = detect_us;
+        best.align_us     = align_us;
+        for (int i = 0; i < 4; ++i)  best.bbox[i]      = faces.at<float>(r, i);
+        for (int i = 0; i < 10; ++i) best.landmarks[i] = faces.at<float>(r, 4 + i);
+    }
+    return passed;
+}
+
+// Best face over a short window of frames. A face scoring `good` or
+// better goes out at once; otherwise the best one held is sent after
+// `window` frames, counted from the first face that passed.
+class BestOfWindow {
+public:
+    BestOfWindow(Mode mode, const QualityGates& gates) : mode_(mode), gates_(gates) {}
+
+    // feed one frame; true once the held face should be sent
+    bool offer(cv::Ptr<cv::FaceDetectorYN>& detector, const Frame& frame) {
+        cv::Mat faces;
+        uint64_t t0 = monotonic_us();
+        detect_faces(detector, frame, faces);
+        uint64_t detect_us = monotonic_us() - t0;
+        competed_ += score_faces(mode_, frame, faces, detect_us, gates_, rejects_,
+                                 held_, have_);
+        if (!have_) return false;
+        ++frames_;
+        return held_.quality >= gates_.good || frames_ >= gates_.window;
+    }
+
+    // the face to send, with how many competed; resets the window
+    Candidate take(uint16_t& window) {
+        window    = (uint16_t)competed_;
+        have_     = false;
+        frames_   = 0;
+        competed_ = 0;
+        return std::move(held_);
+    }
+
+    // forget a held face (the reader paused); rejects are kept
+    void drop() { have_ = false; frames_ = 0; competed_ = 0; }
+    bool holding() const { return have_; }
+
+    // rejects since the last record, cleared once reported
+    RejectCounts& rejects() { return rejects_; }
+
+private:
+    Mode         mode_;
+    QualityGates gates_;
+    Candidate    held_;
+    bool         have_     = false;
+    int          frames_   = 0;
+    int          competed_ = 0;
+    RejectCounts rejects_  = {};
+};
+
+// ============================================================
+//  Framed records (see facelock/capture_protocol.h)
+// ============================================================
+static CaptureRecordHeader make_header(CaptureStatus status) {
+    CaptureRecordHeader h;
+    std::memset(&h, 0, sizeof(h));
+    h.magic      = CAPTURE_MAGIC;
+    h.version    = CAPTURE_VERSION;
+    h.status     = status;
+    h.record_len = sizeof(h);
+    return h;
+}
+
+// stage time in the header's 10 µs units
+static uint16_t time_field(uint64_t us) {
+    return (uint16_t)std::min<uint64_t>(us / 10, UINT16_MAX);
+}
+
+static bool has_rejects(const RejectCounts& rejects) {
+    for (int i = 0; i < CAPTURE_REJECT_COUNT; ++i)
+        if (rejects[i]) return true;
+    return false;
+}
+
+static void take_rejects(CaptureRecordHeader& h, RejectCounts& rejects) {
+    for (int i = 0; i < CAPTURE_REJECT_COUNT; ++i) {
+        h.rejects[i] = rejects[i];
+        rejects[i]   = 0;
+    }
+}
+
+static bool emit_status(CaptureStatus status, RejectCounts& rejects) {
+    CaptureRecordHeader h = make_header(status);
+    take_rejects(h, rejects);
+    return write_all(STDOUT_FILENO, &h, sizeof(h));
+}
+
+static bool emit_face(const Candidate& c, uint16_t window, RejectCounts& rejects) {
+    const cv::Mat& out = c.out;
+    CaptureRecordHeader h = make_header(CAPTURE_OK);
+    h.channels     = (uint8_t)out.channels();
+    h.width        = (uint16_t)out.cols;
+    h.height       = (uint16_t)out.rows;
+    h.payload_len  = (uint32_t)(out.total() * out.elemSize());
+    h.record_len   = (uint32_t)sizeof(h) + h.payload_len;
+    h.timestamp_us = c.timestamp_us;
+    h.score        = c.score;
+    h.sharpness    = c.sharpness;
+    h.brightness   = c.brightness;
+    h.quality      = c.quality;
+    h.yaw          = c.yaw;
+    h.pitch        = c.pitch;
+    h.window       = window;
+    h.detect_time  = time_field(c.detect_us);
+    h.align_time   = time_field(c.align_us);
+    for (int i = 0; i < 4; ++i)  h.bbox[i]      = c.bbox[i];
+    for (int i = 0; i < 10; ++i) h.landmarks[i] = c.landmarks[i];
+    take_rejects(h, rejects);
+
+    return write_all(STDOUT_FILENO, &h, sizeof(h)) &&
+           write_all(STDOUT_FILENO, out.data, h.payload_len);
+}
+
+// Feed one frame to the window and send its pick if it has one.
+// Returns 1 if a face was sent, 0 if not (yet), -1 if the reader went away.
+static int select_and_emit(cv::Ptr<cv::FaceDetectorYN>& detector,
+                           BestOfWindow& window, const Frame& frame) {
+    if (!window.offer(detector, frame)) return 0;
+    uint16_t n = 0;
+    Candidate c = window.take(n);
+    return emit_face(c, n, window.rejects()) ? 1 : -1;
+}
+
+// ============================================================
+//  --serve: persistent mode used by the daemon's CameraService.
+//  A grab thread keeps draining the device into a small ring of
+//  recent frames so requests never see stale driver buffers.
+// ============================================================
+class FrameRing {
+public:
+    static constexpr size_t kSlots = FRAME_RING_SLOTS;
+
+    void push(Frame frame) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        slots_[head_ % kSlots] = std::move(frame);
+        ++head_;
+        cv_.notify_all();
+    }
+
+    uint64_t head() {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return head_;
+    }
+
+    // Wait for a frame newer than `after`; returns its sequence number in `seq`
+    bool wait_newer(uint64_t after, Frame& out, uint64_t& seq,
+                    std::chrono::steady_clock::time_point deadline) {
+        std::unique_lock<std::mutex> lk(mtx_);
+        if (!cv_.wait_until(lk, deadline, [&]{ return head_ > after; }))
+            return false;
+        seq = head_;
+        out = slots_[(head_ - 1) % kSlots];
+        return true;
+    }
+
+private:
+    std::mutex              mtx_;
+    std::condition_variable cv_;
+    Frame                   slots_[kSlots];
+    uint64_t                head_ = 0;
+};
+
+// Non-blocking check for a pending command byte on stdin.
+// Returns the byte, 0 if none is pending, or -1 on EOF.
+static int poll_command(int timeout_ms) {
+    pollfd pfd{STDIN_FILENO, POLLIN, 0};
+    if (poll(&pfd, 1, timeout_ms) <= 0) return 0;
+    char c;
+    ssize_t r = ::read(STDIN_FILENO, &c, 1);
+    if (r <= 0) return -1;
+    return (unsigned char)c;
+}
+
+// Commands are documented in facelock/capture_protocol.h; EOF on stdin exits.
+static int serve(FrameSource& source, cv::Ptr<cv::FaceDetectorYN>& detector,
+                 Mode mode, const QualityGates& gates) {
+    FrameRing ring;
+    BestOfWindow window(mode, gates);
+    std::atomic<bool> running{true};
+
+    std::thread grabber([&] {
+        while (running) {
+            Frame f;
+            if (source.read(f)) {
+                ring.push(std::move(f));
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+    });
+
+    bool ok = true;
+    while (ok) {
+        int cmd = poll_command(-1);
+        if (cmd < 0) break;
+
+        if (cmd == CAPTURE_CMD_FACE) {
+            auto deadline = std::chrono::steady_clock::now() +
+                            std::chrono::milliseconds(2000);
+            uint64_t after = ring.head();
+            Frame frame;
+            uint64_t seq = 0;
+            int r = 0;
+            while (r == 0 && ring.wait_newer(after, frame, seq, deadline)) {
+                after = seq;
+                r = select_and_emit(detector, window, frame);
+            }
+            if (r == 0 && window.holding()) {
+                // out of time before the window closed: the best so far
+                uint16_t n = 0;
+                Candidate c = window.take(n);
+                r = emit_face(c, n, window.rejects()) ? 1 : -1;
+            }
+            if (r == 0) ok = emit_status(CAPTURE_NO_FACE, window.rejects());
+            if (r < 0)  ok = false;
+        } else if (cmd == CAPTURE_CMD_START) {
+            // stream the best face of each window until told to pause
+            uint64_t after = ring.head();
+            auto last_sent = std::chrono::steady_clock::now();
+            while (ok) {
+                int next = poll_command(0);
+                if (next < 0) { ok = false; break; }
+                if (next == CAPTURE_CMD_PAUSE) {
+                    window.drop();
+                    ok = emit_status(CAPTURE_END, window.rejects());
+                    break;
+                }
+                Frame frame;
+                uint64_t seq = 0;
+                auto deadline = std::chrono::steady_clock::now() +
+                                std::chrono::milliseconds(100);
+                if (!ring.wait_newer(after, frame, seq, deadline)) continue;
+                after = seq;
+                int r = select_and_emit(detector, window, frame);
+                auto now = std::chrono::steady_clock::now();
+                if (r < 0) {
+                    ok = false;
+                } else if (r > 0) {
+                    last_sent = now;
+                } else if (now - last_sent >= REJECT_REPORT_INTERVAL &&
+                           has_rejects(window.rejects())) {
+                    // nothing passing: report why, so the daemon can tell the user
+                    ok = emit_status(CAPTURE_NO_FACE, window.rejects());
+                    last_sent = now;
+                }
+            }
+        } else if (cmd == CAPTURE_CMD_PAUSE) {
+            ok = emit_status(CAPTURE_END, window.rejects());   // already paused; still ack
+        }
+    }
+
+    running = false;
+    grabber.join();
+    return 0;
+}
+
+// ============================================================
+//  --stream: emit records until the reader closes the pipe
+//  (or --count faces have been sent)
+// ============================================================
+// Failed reads in a row (10 ms apart) before the camera counts as gone
+static constexpr int STREAM_MAX_READ_FAILS = 300;
+
+static int stream(FrameSource& source, cv::Ptr<cv::FaceDetectorYN>& detector,
+                  Mode mode, const QualityGates& gates, int count) {
+    BestOfWindow window(mode, gates);
+    int sent  = 0;
+    int fails = 0;
+    while (count <= 0 || sent < count) {
+        Frame frame;
+        if (!source.read(frame)) {
+            // unplugged or failing: back off like the --serve grabber,
+            // and give up rather than spin
+            if (++fails >= STREAM_MAX_READ_FAILS) {
+                std::cerr << "facelock_camera_helper: camera stopped delivering frames\n";
+                return 3;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        fails = 0;
+
+        int r = select_and_emit(detector, window, frame);
+        if (r < 0) break;     // reader closed the pipe
+        sent += r;
+    }
+    return 0;
+}
+
 int main(int argc, char** argv) {
-    Mode mode = parse_mode(argc, argv);
-    int  cam  = parse_camera(argc, argv);
+    Mode mode  = parse_mode(argc, argv);
+    int  cam   = parse_camera(argc, argv);
+    bool serve_mode  = has_flag(argc, argv, "--serve");
+    bool stream_mode = has_flag(argc, argv, "--stream");
+    QualityGates gates = QualityGates::parse(argc, argv);
 
-    cv::VideoCapture cap(cam);
-    if (!cap.isOpened()) return 1;
+    // a closed pipe is the normal way to stop --serve / --stream
+    if (serve_mode || stream_mode) std::signal(SIGPIPE, SIG_IGN);
 
-    cap.set(cv::CAP_PROP_FRAME_WIDTH,  640);
-    cap.set(cv::CAP_PROP_FRAME_HEIGHT, 480);
+    FrameSource source;
+    if (!source.open(cam, parse_backend(argc, argv))) return 1;
 
     cv::Ptr<cv::FaceDetectorYN> detector = cv::FaceDetectorYN::create(
-        DETECTOR_MODEL, "", {640, 480},
+        DETECTOR_MODEL, "", source.detector_size(),
         0.6f, 0.3f, 5000
     );
     if (detector.empty()) return 2;
 
-    // warmup
-    cv::Mat junk;
+    // warmup — lets auto exposure settle. V4L2 reads block at the frame
+    // rate; cv::VideoCapture may hand back buffered frames immediately.
+    Frame junk;
     for (int i = 0; i < 10; ++i) {
-        cap >> junk;
-        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        source.read(junk);
+        if (!source.is_v4l2())
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));
     }
+    junk = Frame{};
+
+    if (serve_mode) {
+        // tell the daemon the device and detector are ready
+        if (!write_all(STDOUT_FILENO, &CAPTURE_READY, 1)) return 0;
+        return serve(source, detector, mode, gates);
+    }
+
+    if (stream_mode)
+        return stream(source, detector, mode, gates, parse_int(argc, argv, "--count", 0));
 
     auto start = std::chrono::steady_clock::now();
 
     while (true) {
-        cv::Mat frame;
-        cap >> frame;
-        if (frame.empty()) continue;
-
-        cv::Mat faces;
-        detector->detect(frame, faces);
-
-        if (faces.rows > 0) {
-            // pick highest confidence face
-            int best = 0;
-            float best_score = faces.at<float>(0, 14);
-            for (int i = 1; i < faces.rows; ++i) {
-                float s = faces.at<float>(i, 14);
-                if (s > best_score) { best_score = s; best = i; }
-            }
+        Frame frame;
+        if (source.read(frame)) {
+            cv::Mat faces;
+            detect_faces(detector, frame, faces);
 
-            if (mode == Mode::BGR112) {
-                cv::Mat aligned = align_face(frame, faces, best);
-                std::cout.write(
-                    reinterpret_cast<char*>(aligned.data),
-                    112 * 112 * 3
-                );
-            } else {
-                // legacy gray200 — no alignment
-                int x = std::max(0, (int)faces.at<float>(best, 0));
-                int y = std::max(0, (int)faces.at<float>(best, 1));
-                int w = std::min((int)faces.at<float>(best, 2), frame.cols - x);
-                int h = std::min((int)faces.at<float>(best, 3), frame.rows - y);
-                if (w > 0 && h > 0) {
-                    cv::Mat gray;
-                    cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
-                    cv::Mat crop = gray(cv::Rect(x,y,w,h)).clone();
-                    cv::resize(crop, crop, {200, 200});
-                    std::cout.write(reinterpret_cast<char*>(crop.data), 200*200);
-                }
+            int best = best_face(faces);
+            if (best >= 0) {
+                cv::Mat out = make_output(mode, frame, faces, best);
+                if (!out.empty())
+                    std::cout.write(reinterpret_cast<char*>(out.data),
+                                    output_size(mode));
+                return 0;
             }
-            return 0;
         }
 
         auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
@@ -130,4 +737,4 @@ int main(int argc, char** argv) {
     }
 
     return 3;
-}
\ No newline at end of file
+}
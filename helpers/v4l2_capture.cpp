@@ -0,0 +1,278 @@
+#include "v4l2_capture.h"
+
+#include <linux/videodev2.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <algorithm>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+using namespace facelock;
+
+// Driver-side queue depth. The helper holds at most a handful of frames
+// (frame ring + the one being detected), the rest stay with the driver.
+static constexpr uint32_t REQ_BUFFERS = 8;
+
+static int xioctl(int fd, unsigned long req, void* arg) {
+    int r;
+    do { r = ioctl(fd, req, arg); } while (r < 0 && errno == EINTR);
+    return r;
+}
+
+static uint64_t monotonic_us() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+V4L2Capture::~V4L2Capture() { close(); }
+
+bool V4L2Capture::set_format(uint32_t fourcc, int width, int height) {
+    v4l2_format fmt;
+    std::memset(&fmt, 0, sizeof(fmt));
+    fmt.type                = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt.fmt.pix.width       = (uint32_t)width;
+    fmt.fmt.pix.height      = (uint32_t)height;
+    fmt.fmt.pix.pixelformat = fourcc;
+    fmt.fmt.pix.field       = V4L2_FIELD_NONE;
+
+    if (xioctl(fd_, VIDIOC_S_FMT, &fmt) < 0) return false;
+    if (fmt.fmt.pix.pixelformat != fourcc) return false;   // driver substituted
+
+    fourcc_ = fourcc;
+    width_  = (int)fmt.fmt.pix.width;
+    height_ = (int)fmt.fmt.pix.height;
+    stride_ = fmt.fmt.pix.bytesperline ? fmt.fmt.pix.bytesperline
+                                       : (size_t)width_ * 2;
+    return true;
+}
+
+bool V4L2Capture::open(int index, int width, int height, uint32_t min_buffers) {
+    close();
+
+    std::string dev = "/dev/video" + std::to_string(index);
+    int fd = ::open(dev.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return false;
+    {
+        std::lock_guard<std::mutex> lk(qbuf_mtx_);
+        fd_ = fd;
+    }
+
+    v4l2_capability cap;
+    std::memset(&cap, 0, sizeof(cap));
+    uint32_t caps = 0;
+    if (xioctl(fd_, VIDIOC_QUERYCAP, &cap) == 0)
+        caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps
+                                                         : cap.capabilities;
+    if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING)) {
+        close();
+        return false;
+    }
+
+    // YUYV converts for free on the region we need; MJPEG needs a decode
+    if (!set_format(V4L2_PIX_FMT_YUYV, width, height) &&
+        !set_format(V4L2_PIX_FMT_MJPEG, width, height)) {
+        close();
+        return false;
+    }
+
+    v4l2_requestbuffers req;
+    std::memset(&req, 0, sizeof(req));
+    req.count  = std::max(REQ_BUFFERS, min_buffers);
+    req.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(fd_, VIDIOC_REQBUFS, &req) < 0 || req.count < min_buffers) {
+        close();
+        return false;
+    }
+
+    maps_.resize(req.count);
+    for (uint32_t i = 0; i < req.count; ++i) {
+        v4l2_buffer buf;
+        std::memset(&buf, 0, sizeof(buf));
+        buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index  = i;
+        if (xioctl(fd_, VIDIOC_QUERYBUF, &buf) < 0) { close(); return false; }
+
+        void* addr = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, fd_, buf.m.offset);
+        if (addr == MAP_FAILED) { close(); return false; }
+        maps_[i] = {addr, buf.length};
+
+        if (xioctl(fd_, VIDIOC_QBUF, &buf) < 0) { close(); return false; }
+    }
+
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(fd_, VIDIOC_STREAMON, &type) < 0) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void V4L2Capture::close() {
+    std::lock_guard<std::mutex> lk(qbuf_mtx_);
+    if (fd_ < 0) return;
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    xioctl(fd_, VIDIOC_STREAMOFF, &type);
+    for (auto& m : maps_)
+        if (m.addr) munmap(m.addr, m.length);
+    maps_.clear();
+    ::close(fd_);
+    fd_ = -1;
+}
+
+void V4L2Capture::requeue(uint32_t index) {
+    std::lock_guard<std::mutex> lk(qbuf_mtx_);
+    if (fd_ < 0) return;
+    v4l2_buffer buf;
+    std::memset(&buf, 0, sizeof(buf));
+    buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index  = index;
+    xioctl(fd_, VIDIOC_QBUF, &buf);
+}
+
+std::shared_ptr<const V4L2Buffer> V4L2Capture::grab(int timeout_ms) {
+    if (fd_ < 0) return nullptr;
+
+    pollfd pfd{fd_, POLLIN, 0};
+    int pr;
+    do { pr = poll(&pfd, 1, timeout_ms); } while (pr < 0 && errno == EINTR);
+    if (pr <= 0) return nullptr;
+
+    v4l2_buffer buf;
+    std::memset(&buf, 0, sizeof(buf));
+    buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    {
+        std::lock_guard<std::mutex> lk(qbuf_mtx_);
+        if (xioctl(fd_, VIDIOC_DQBUF, &buf) < 0) return nullptr;
+    }
+    if (buf.flags & V4L2_BUF_FLAG_ERROR) {
+        requeue(buf.index);
+        return nullptr;
+    }
+
+    auto* out = new V4L2Buffer;
+    out->data   = static_cast<const uint8_t*>(maps_[buf.index].addr);
+    out->bytes  = buf.bytesused;
+    out->stride = stride_;
+    out->width  = width_;
+    out->height = height_;
+    out->fourcc = fourcc_;
+    if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+        V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+        out->timestamp_us = (uint64_t)buf.timestamp.tv_sec * 1000000u +
+                            (uint64_t)buf.timestamp.tv_usec;
+    else
+        out->timestamp_us = monotonic_us();
+
+    uint32_t index = buf.index;
+    return std::shared_ptr<const V4L2Buffer>(out, [this, index](const V4L2Buffer* b) {
+        requeue(index);
+        delete b;
+    });
+}
+
+// ============================================================
+//  Conversions straight from driver buffers
+// ============================================================
+
+// BT.601 limited range, same coefficients as cv::COLOR_YUV2BGR_YUYV
+static inline uint8_t clamp_u8(int v) {
+    return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+static inline void yuv_to_bgr(int y, int u, int v, uint8_t* bgr) {
+    int c = (y - 16) * 1192;        // 1.164 * 1024
+    int d = u - 128;
+    int e = v - 128;
+    bgr[0] = clamp_u8((c + 2066 * d + 512) >> 10);            // B
+    bgr[1] = clamp_u8((c - 833 * e - 400 * d + 512) >> 10);   // G
+    bgr[2] = clamp_u8((c + 1634 * e + 512) >> 10);            // R
+}
+
+bool facelock::v4l2_detector_view(const V4L2Buffer& buf, cv::Mat& out) {
+    if (buf.fourcc == V4L2_PIX_FMT_MJPEG) {
+        // wraps the mmap'd buffer, no copy
+        cv::Mat jpeg(1, (int)buf.bytes, CV_8UC1, const_cast<uint8_t*>(buf.data));
+        out = cv::imdecode(jpeg, cv::IMREAD_REDUCED_COLOR_2);
+        return !out.empty();
+    }
+    if (buf.fourcc != V4L2_PIX_FMT_YUYV) return false;
+    if (buf.bytes < buf.stride * (size_t)buf.height) return false;
+
+    // one output pixel per YUYV macropixel on every other row
+    const int W = buf.width / 2, H = buf.height / 2;
+    out.create(H, W, CV_8UC3);
+    for (int y = 0; y < H; ++y) {
+        const uint8_t* src = buf.data + (size_t)(2 * y) * buf.stride;
+        uint8_t*       dst = out.ptr<uint8_t>(y);
+        for (int x = 0; x < W; ++x, src += 4, dst += 3)
+            yuv_to_bgr((src[0] + src[2] + 1) >> 1, src[1], src[3], dst);
+    }
+    return true;
+}
+
+bool facelock::v4l2_warp(const V4L2Buffer& buf, const cv::Mat& affine,
+                         cv::Size size, cv::Mat& out) {
+    if (affine.empty()) return false;
+
+    if (buf.fourcc == V4L2_PIX_FMT_MJPEG) {
+        cv::Mat jpeg(1, (int)buf.bytes, CV_8UC1, const_cast<uint8_t*>(buf.data));
+        cv::Mat full = cv::imdecode(jpeg, cv::IMREAD_COLOR);
+        if (full.empty()) return false;
+        cv::warpAffine(full, out, affine, size,
+                       cv::INTER_LINEAR, cv::BORDER_REFLECT);
+        return true;
+    }
+    if (buf.fourcc != V4L2_PIX_FMT_YUYV) return false;
+    if (buf.bytes < buf.stride * (size_t)buf.height) return false;
+
+    cv::Mat inv;
+    cv::invertAffineTransform(affine, inv);
+    cv::Mat_<double> m = inv;   // output → frame
+    const double a = m(0,0), b = m(0,1), c = m(0,2);
+    const double d = m(1,0), e = m(1,1), f = m(1,2);
+
+    const int W = buf.width, H = buf.height;
+    out.create(size.height, size.width, CV_8UC3);
+
+    for (int oy = 0; oy < size.height; ++oy) {
+        uint8_t* dst = out.ptr<uint8_t>(oy);
+        for (int ox = 0; ox < size.width; ++ox, dst += 3) {
+            float sx = (float)(a * ox + b * oy + c);
+            float sy = (float)(d * ox + e * oy + f);
+            sx = std::min(std::max(sx, 0.f), (float)(W - 1));
+            sy = std::min(std::max(sy, 0.f), (float)(H - 1));
+
+            int   x0 = (int)sx, y0 = (int)sy;
+            int   x1 = std::min(x0 + 1, W - 1), y1 = std::min(y0 + 1, H - 1);
+            float fx = sx - x0, fy = sy - y0;
+
+            const uint8_t* r0 = buf.data + (size_t)y0 * buf.stride;
+            const uint8_t* r1 = buf.data + (size_t)y1 * buf.stride;
+
+            // luma: bilinear over full resolution
+            float top = r0[2*x0] + fx * (r0[2*x1] - r0[2*x0]);
+            float bot = r1[2*x0] + fx * (r1[2*x1] - r1[2*x0]);
+            int   Y   = (int)(top + fy * (bot - top) + 0.5f);
+
+            // chroma: nearest macropixel (already half horizontal resolution)
+            const uint8_t* mp = (fy < 0.5f ? r0 : r1) + 4 * ((fx < 0.5f ? x0 : x1) / 2);
+            yuv_to_bgr(Y, mp[1], mp[3], dst);
+        }
+    }
+    return true;
+}
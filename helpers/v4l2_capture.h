@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <opencv2/core.hpp>
+
+namespace facelock {
+
+// One mmap'd driver buffer on loan from V4L2Capture. It is queued back to
+// the driver when the last shared_ptr reference is dropped, so every frame
+// must be released before the capture is closed.
+struct V4L2Buffer {
+    const uint8_t* data         = nullptr;
+    size_t         bytes        = 0;    // bytesused
+    size_t         stride       = 0;    // bytesperline (YUYV)
+    int            width        = 0;
+    int            height       = 0;
+    uint32_t       fourcc       = 0;    // V4L2_PIX_FMT_YUYV or _MJPEG
+    uint64_t       timestamp_us = 0;    // CLOCK_MONOTONIC
+};
+
+// Minimal V4L2 streaming capture (VIDIOC_REQBUFS + mmap). Frames are
+// handed out in place, without the copy + BGR conversion that
+// cv::VideoCapture performs on every frame.
+class V4L2Capture {
+public:
+    V4L2Capture() = default;
+    ~V4L2Capture();
+
+    V4L2Capture(const V4L2Capture&) = delete;
+    V4L2Capture& operator=(const V4L2Capture&) = delete;
+
+    // open /dev/video<index>, negotiate YUYV (preferred) or MJPEG at the
+    // requested size and start streaming. Fails if the driver grants
+    // fewer than `min_buffers`: the caller may hold min_buffers - 1
+    // frames at once and one must stay queued, or grab() never returns.
+    bool open(int index, int width, int height, uint32_t min_buffers = 3);
+    void close();
+    bool is_open() const { return fd_ >= 0; }
+
+    // dequeue the next filled buffer; nullptr on timeout or error
+    std::shared_ptr<const V4L2Buffer> grab(int timeout_ms = 1000);
+
+    uint32_t fourcc() const { return fourcc_; }
+    int      width()  const { return width_; }
+    int      height() const { return height_; }
+
+private:
+    struct Mapping {
+        void*  addr   = nullptr;
+        size_t length = 0;
+    };
+
+    int                  fd_     = -1;
+    uint32_t             fourcc_ = 0;
+    int                  width_  = 0;
+    int                  height_ = 0;
+    size_t               stride_ = 0;
+    std::vector<Mapping> maps_;
+    std::mutex           qbuf_mtx_;
+
+    bool set_format(uint32_t fourcc, int width, int height);
+    void requeue(uint32_t index);
+};
+
+// Half-resolution BGR view of a driver buffer for the face detector.
+// YUYV is decimated straight from the packed data; MJPEG uses libjpeg's
+// DCT-domain downscaling. Frame coordinates = view coordinates * 2.
+bool v4l2_detector_view(const V4L2Buffer& buf, cv::Mat& out_bgr);
+
+// Warp a buffer through `affine` (2x3, frame → output) into `size`,
+// converting only the output pixels for YUYV.
+bool v4l2_warp(const V4L2Buffer& buf, const cv::Mat& affine,
+               cv::Size size, cv::Mat& out_bgr);
+
+} // namespace facelock
@@ -10,61 +10,178 @@
 #include <sys/select.h>
 
 #include <unistd.h>
+#include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #define FACELOCK_SOCK "/run/facelock/facelock.sock"
-#define FACELOCK_TIMEOUT_SEC 6
-#define FACELOCK_MAX_TRIES 3
-
-static int facelock_single_try(pam_handle_t *pamh, const char *user)
+#define FACELOCK_TIMEOUT_SEC 6          /* silence tolerated from the daemon */
+#define FACELOCK_DEADLINE_MS 8000       /* overall budget, "deadline=<ms>" overrides */
+
+/* One persistent protocol-v3 connection per PAM conversation. Replies are
+ * newline-terminated and carry the id of the request they answer. */
+struct facelock_conn {
+    int fd;
+    unsigned next_id;
+    size_t len;
+    char buf[1024];
+};
+
+static int facelock_connect(pam_handle_t *pamh, struct facelock_conn *c)
 {
-    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (fd < 0) {
+    c->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    c->len = 0;
+    if (c->fd < 0) {
         pam_syslog(pamh, LOG_ERR, "socket() failed");
-        return PAM_IGNORE;
+        return -1;
     }
 
     struct sockaddr_un addr = {0};
     addr.sun_family = AF_UNIX;
     strncpy(addr.sun_path, FACELOCK_SOCK, sizeof(addr.sun_path) - 1);
 
-    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
         pam_syslog(pamh, LOG_INFO, "daemon unavailable");
-        close(fd);
-        return PAM_IGNORE;
+        close(c->fd);
+        c->fd = -1;
+        return -1;
     }
+    return 0;
+}
 
-    char req[256];
-    snprintf(req, sizeof(req),
-             "{\"cmd\":\"auth\",\"user\":\"%s\"}\n", user);
-
-    write(fd, req, strlen(req));
-
-    fd_set rfds;
-    FD_ZERO(&rfds);
-    FD_SET(fd, &rfds);
-
-    struct timeval tv = { FACELOCK_TIMEOUT_SEC, 0 };
+static void facelock_disconnect(struct facelock_conn *c)
+{
+    if (c->fd >= 0)
+        close(c->fd);
+    c->fd = -1;
+    c->len = 0;
+}
 
-    if (select(fd + 1, &rfds, NULL, NULL, &tv) <= 0) {
-        close(fd);
-        return PAM_IGNORE;
+static int write_all(int fd, const char *p, size_t n)
+{
+    while (n > 0) {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return -1;
+        p += w;
+        n -= (size_t)w;
     }
+    return 0;
+}
 
-    char buf[512] = {0};
-    ssize_t n = read(fd, buf, sizeof(buf) - 1);
-    close(fd);
-
-    if (n <= 0)
-        return PAM_IGNORE;
+/* Read messages until the next one for `id` (a progress event or the
+ * final reply) arrives; it is left NUL-terminated in `line`. Returns 0 on
+ * success, -1 if the connection failed (the caller may reconnect) and -2
+ * on timeout. */
+static int read_reply(struct facelock_conn *c, unsigned id,
+                      char *line, size_t line_size, int timeout_sec)
+{
+    char tag[32], tag_end[32];
+    snprintf(tag, sizeof(tag), "\"id\":%u,", id);
+    snprintf(tag_end, sizeof(tag_end), "\"id\":%u}", id);
+
+    for (;;) {
+        char *nl = memchr(c->buf, '\n', c->len);
+        while (nl) {
+            size_t n = (size_t)(nl - c->buf);
+            int ours = 0;
+            if (n < line_size) {
+                memcpy(line, c->buf, n);
+                line[n] = '\0';
+                ours = strstr(line, tag) || strstr(line, tag_end);
+            }
+            c->len -= n + 1;
+            memmove(c->buf, nl + 1, c->len);
+            if (ours)
+                return 0;
+            nl = memchr(c->buf, '\n', c->len);
+        }
+        if (c->len == sizeof(c->buf))
+            return -1;   /* oversized reply, resynchronise on a new connection */
+
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        FD_SET(c->fd, &rfds);
+        struct timeval tv = { timeout_sec, 0 };
+
+        int sr = select(c->fd + 1, &rfds, NULL, NULL, &tv);
+        if (sr < 0 && errno == EINTR)
+            continue;
+        if (sr <= 0)
+            return -2;
+
+        ssize_t r = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        c->len += (size_t)r;
+    }
+}
 
-    if (strstr(buf, "\"match\":true"))
-        return PAM_SUCCESS;
+/* Show a daemon progress event ("face_detected", "no_face", ...) through
+ * the PAM conversation */
+static void facelock_progress(pam_handle_t *pamh, int flags, const char *line)
+{
+    if (flags & PAM_SILENT)
+        return;
+    if (strstr(line, "\"event\":\"face_detected\""))
+        pam_info(pamh, "Face detected, verifying...");
+    else if (strstr(line, "\"event\":\"no_face\""))
+        pam_info(pamh, "Look at the camera");
+    else if (strstr(line, "\"event\":\"no_match\""))
+        pam_info(pamh, "Face not recognised, still trying...");
+}
 
-    if (strstr(buf, "\"match\":false"))
-        return PAM_AUTH_ERR;
+/* One auth request: the daemon keeps capturing until it gets a match or
+ * `deadline_ms` runs out, streaming progress events until the result. */
+static int facelock_auth(pam_handle_t *pamh, int flags,
+                         struct facelock_conn *c, const char *user,
+                         int deadline_ms)
+{
+    char req[256];
+    char line[512];
+
+    /* allow the daemon its whole budget plus the usual silence */
+    int wait_sec = deadline_ms / 1000 + FACELOCK_TIMEOUT_SEC;
+
+    /* the daemon may have restarted since it was last used: reconnect once
+     * and resend, but only while it has not started on our request */
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (c->fd < 0 && facelock_connect(pamh, c) < 0)
+            return PAM_IGNORE;
+
+        unsigned id = ++c->next_id;
+        snprintf(req, sizeof(req),
+                 "{\"v\":3,\"id\":%u,\"cmd\":\"auth\",\"user\":\"%s\","
+                 "\"deadline_ms\":%d}\n", id, user, deadline_ms);
+
+        int r = write_all(c->fd, req, strlen(req));
+        int events = 0;
+        while (r == 0) {
+            r = read_reply(c, id, line, sizeof(line), wait_sec);
+            if (r == 0 && !strstr(line, "\"event\":"))
+                break;   /* final reply */
+            if (r == 0) {
+                ++events;
+                facelock_progress(pamh, flags, line);
+            }
+        }
+        if (r == 0) {
+            if (strstr(line, "\"match\":true"))
+                return PAM_SUCCESS;
+            if (strstr(line, "\"match\":false"))
+                return PAM_AUTH_ERR;
+            return PAM_IGNORE;
+        }
 
+        facelock_disconnect(c);
+        if (r == -2 || events > 0)
+            return PAM_IGNORE;   /* timed out or dropped mid-request */
+    }
     return PAM_IGNORE;
 }
 
@@ -73,23 +190,32 @@ PAM_EXTERN int pam_sm_authenticate(
 {
     openlog("pam_facelock", LOG_PID, LOG_AUTHPRIV);
 
+    int deadline_ms = FACELOCK_DEADLINE_MS;
+    for (int i = 0; i < argc; ++i) {
+        if (strncmp(argv[i], "deadline=", 9) == 0) {
+            int v = atoi(argv[i] + 9);
+            if (v > 0)
+                deadline_ms = v;
+        }
+    }
+
     const char *user = NULL;
     if (pam_get_user(pamh, &user, NULL) != PAM_SUCCESS || !user) {
         closelog();
         return PAM_IGNORE;
     }
 
-    for (int i = 0; i < FACELOCK_MAX_TRIES; ++i) {
-        int r = facelock_single_try(pamh, user);
-        if (r != PAM_AUTH_ERR) {
-            closelog();
-            return r;
-        }
-        sleep(1);
-    }
+    struct facelock_conn conn = { .fd = -1 };
+    int result = facelock_auth(pamh, flags, &conn, user, deadline_ms);
 
+    /* a face that never matched falls through to the next module
+     * (password) rather than failing the stack */
+    if (result == PAM_AUTH_ERR)
+        result = PAM_IGNORE;
+
+    facelock_disconnect(&conn);
     closelog();
-    return PAM_IGNORE;
+    return result;
 }
 
 PAM_EXTERN int pam_sm_setcred(
@@ -114,21 +114,40 @@ install -m 755 build-pam/pam_facelock.so /lib/x86_64-linux-gnu/security/
 echo "[*] Installing facelock CLI"
 install -m 755 scripts/facelock /usr/bin/facelock
 
-echo "[*] Installing systemd service"
+echo "[*] Installing systemd socket and service"
+tee /etc/systemd/system/facelock.socket >/dev/null <<'EOF'
+[Unit]
+Description=AstraLock biometric authentication socket
+
+[Socket]
+ListenStream=/run/facelock/facelock.sock
+SocketMode=0666
+DirectoryMode=0755
+
+[Install]
+WantedBy=sockets.target
+EOF
+
 tee /etc/systemd/system/facelock.service >/dev/null <<'EOF'
 [Unit]
 Description=AstraLock biometric authentication daemon
-After=multi-user.target
+Requires=facelock.socket
+After=facelock.socket
 
 [Service]
-Type=simple
+Type=notify
+NotifyAccess=main
 ExecStart=/usr/lib/facelock/facelockd
+ExecReload=/bin/kill -HUP $MAINPID
 Restart=on-failure
+TimeoutStartSec=120
 User=root
 Group=root
 RuntimeDirectory=facelock
 RuntimeDirectoryMode=0755
-ReadWritePaths=/run/facelock /var/lib/facelock
+RuntimeDirectoryPreserve=yes
+CacheDirectory=facelock
+ReadWritePaths=/run/facelock /var/lib/facelock /var/cache/facelock
 NoNewPrivileges=true
 
 [Install]
@@ -137,7 +156,8 @@ EOF
 
 systemctl daemon-reexec
 systemctl daemon-reload
-systemctl enable facelock
+systemctl enable facelock.socket facelock
+systemctl restart facelock.socket
 systemctl restart facelock
 
 echo "[*] Waiting for socket..."
@@ -237,5 +257,5 @@ echo "╠═══════════════════════
 echo "║  Face auth active for: sudo, login, lock screen               ║"
 echo "║  Config:  /etc/facelock/facelock.conf                         ║"
 echo "║    → Set CAMERA_DEVICE=N for IR camera  (ls /dev/video*)      ║"
-echo "║    → Restart after config changes: systemctl restart facelock ║"
+echo "║    → Apply config changes:   systemctl reload facelock        ║"
 echo "╚═══════════════════════════════════════════════════════════════╝"
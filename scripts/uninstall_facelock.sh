@@ -2,8 +2,8 @@
 set -e
 
 echo "[*] Stopping service"
-systemctl stop facelock || true
-systemctl disable facelock || true
+systemctl stop facelock facelock.socket || true
+systemctl disable facelock facelock.socket || true
 
 echo "[*] Removing PAM rules"
 for svc in /etc/pam.d/sudo /etc/pam.d/login \
@@ -17,6 +17,7 @@ done
 
 echo "[*] Removing files"
 rm -f /etc/systemd/system/facelock.service
+rm -f /etc/systemd/system/facelock.socket
 rm -f /etc/pam.d/facelock-test
 rm -f /lib/x86_64-linux-gnu/security/pam_facelock.so
 rm -f /usr/bin/facelock